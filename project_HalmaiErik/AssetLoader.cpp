@@ -0,0 +1,142 @@
+#include "AssetLoader.hpp"
+
+#include <atomic>
+
+namespace gps {
+
+    // State shared by the jobs of one model load
+    struct ModelLoad {
+        Model3D* model;
+        std::string fileName;
+        bool parsed = false;
+        ModelData data;
+        PendingImages images;
+        std::atomic<size_t> remainingDecodes;
+        std::promise<void> done;
+    };
+
+    // State shared by the jobs of one skybox load
+    struct SkyBoxLoad {
+        SkyBox* skybox;
+        std::vector<std::shared_future<Image>> faceImages;
+        std::atomic<size_t> remainingDecodes;
+        std::promise<void> done;
+    };
+
+    AssetLoader::AssetLoader() : workers(ThreadPool::getInstance()), pendingLoads(0) {
+    }
+
+    std::shared_future<void> AssetLoader::LoadModel(Model3D& model, std::string fileName, std::string basePath) {
+        std::shared_ptr<ModelLoad> load = std::make_shared<ModelLoad>();
+        load->model = &model;
+        load->fileName = fileName;
+        std::shared_future<void> result = load->done.get_future().share();
+
+        {
+            std::lock_guard<std::mutex> lock(uploadsMutex);
+            pendingLoads++;
+        }
+
+        // last stage, runs on the GL thread
+        std::function<void()> upload = [load]() {
+            if (!load->parsed) {
+                std::cerr << "ERROR: could not load " << load->fileName << std::endl;
+                exit(1);
+            }
+            load->model->UploadModel(load->data, &load->images);
+            load->data = ModelData();
+            load->images.clear();
+            load->done.set_value();
+        };
+
+        workers.Submit([this, load, basePath, upload]() {
+            load->parsed = Model3D::ParseModel(load->fileName, basePath, load->data);
+
+            std::vector<std::string> texturePaths;
+            if (load->parsed) {
+                texturePaths = load->data.getTexturePaths();
+            }
+            if (texturePaths.empty()) {
+                QueueUpload(upload);
+                return;
+            }
+
+            // fan out one decode per texture, the last one to finish queues the upload;
+            // the extra count keeps the upload back until every future is stored in `images`
+            load->remainingDecodes = texturePaths.size() + 1;
+            std::function<void()> onDecoded = [this, load, upload]() {
+                if (--load->remainingDecodes == 0) {
+                    QueueUpload(upload);
+                }
+            };
+            for (size_t i = 0; i < texturePaths.size(); i++) {
+                // shared with other loads of the same texture, invalid if it is already on the GPU
+                std::shared_future<Image> image = Model3D::DecodeTextureAsync(texturePaths[i], onDecoded);
+                if (image.valid()) {
+                    load->images[texturePaths[i]] = image;
+                }
+            }
+            onDecoded();
+        });
+
+        return result;
+    }
+
+    std::shared_future<void> AssetLoader::LoadSkyBox(SkyBox& skybox, std::vector<const GLchar*> cubeMapFaces) {
+        std::shared_ptr<SkyBoxLoad> load = std::make_shared<SkyBoxLoad>();
+        load->skybox = &skybox;
+        load->remainingDecodes = cubeMapFaces.size() + 1;
+        std::shared_future<void> result = load->done.get_future().share();
+
+        {
+            std::lock_guard<std::mutex> lock(uploadsMutex);
+            pendingLoads++;
+        }
+
+        std::function<void()> upload = [load]() {
+            load->skybox->Upload(load->faceImages);
+            load->faceImages.clear();
+            load->done.set_value();
+        };
+
+        std::function<void()> onDecoded = [this, load, upload]() {
+            if (--load->remainingDecodes == 0) {
+                QueueUpload(upload);
+            }
+        };
+        for (size_t i = 0; i < cubeMapFaces.size(); i++) {
+            load->faceImages.push_back(SkyBox::DecodeFaceAsync(cubeMapFaces[i], onDecoded));
+        }
+        onDecoded();
+
+        return result;
+    }
+
+    void AssetLoader::QueueUpload(std::function<void()> upload) {
+        {
+            std::lock_guard<std::mutex> lock(uploadsMutex);
+            uploads.push_back(std::move(upload));
+        }
+        uploadsAvailable.notify_one();
+    }
+
+    void AssetLoader::WaitAll() {
+        while (true) {
+            std::function<void()> upload;
+            {
+                std::unique_lock<std::mutex> lock(uploadsMutex);
+                uploadsAvailable.wait(lock, [this]() { return !uploads.empty() || pendingLoads == 0; });
+                if (uploads.empty()) {
+                    return;
+                }
+                upload = std::move(uploads.front());
+                uploads.pop_front();
+            }
+
+            upload();
+
+            std::lock_guard<std::mutex> lock(uploadsMutex);
+            pendingLoads--;
+        }
+    }
+}
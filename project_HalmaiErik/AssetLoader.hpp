@@ -0,0 +1,48 @@
+#ifndef AssetLoader_hpp
+#define AssetLoader_hpp
+
+#include "Model3D.hpp"
+#include "SkyBox.hpp"
+#include "ThreadPool.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Loads models and skyboxes as a small job graph:
+    // .obj/.mtl parse -> texture decodes (TextureDecoder) -> GL upload (the thread that calls WaitAll),
+    // the first two on the shared ThreadPool
+    class AssetLoader
+    {
+    public:
+        AssetLoader();
+
+        // Starts loading a model, the future becomes ready once its meshes and textures are on the GPU
+        std::shared_future<void> LoadModel(Model3D& model, std::string fileName, std::string basePath);
+
+        // Starts loading the six faces of a skybox
+        std::shared_future<void> LoadSkyBox(SkyBox& skybox, std::vector<const GLchar*> cubeMapFaces);
+
+        // Runs the GL uploads on the calling thread, which must own the GL context, until every load is done
+        void WaitAll();
+
+    private:
+        ThreadPool& workers;
+
+        // GL work produced by the workers, only ever run by WaitAll
+        std::deque<std::function<void()>> uploads;
+        std::mutex uploadsMutex;
+        std::condition_variable uploadsAvailable;
+        size_t pendingLoads;
+
+        void QueueUpload(std::function<void()> upload);
+    };
+}
+
+#endif /* AssetLoader_hpp */
@@ -0,0 +1,36 @@
+#include "FrameUniforms.hpp"
+
+namespace gps {
+
+    static_assert(sizeof(FrameData) == (2 + SHADOW_CASCADE_COUNT) * 64 + 16 + 3 * 16 + 3 * 16,
+        "FrameData must match the std140 layout of the FrameData block");
+
+    void FrameData::setLightDirMatrix(const glm::mat3& matrix) {
+        for (int i = 0; i < 3; i++) {
+            lightDirMatrix[i] = glm::vec4(matrix[i], 0.0f);
+        }
+    }
+
+    FrameUniforms::FrameUniforms() : buffer(0) {
+    }
+
+    void FrameUniforms::Init() {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, BLOCK_FRAME_DATA, buffer);
+    }
+
+    void FrameUniforms::Update(const FrameData& data) {
+        // respecifying the whole store lets the driver hand out fresh memory instead of waiting on last frame's draws
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), &data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void FrameUniforms::Delete() {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef FrameUniforms_hpp
+#define FrameUniforms_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    // Shadow cascades the camera frustum is split into; shaders/frameData.glsl declares the same count
+    const int SHADOW_CASCADE_COUNT = 3;
+
+    // CPU copy of the FrameData uniform block, laid out as std140
+    struct FrameData {
+        glm::mat4 view;
+        glm::mat4 projection;
+        // world to light clip space of each cascade, nearest first
+        glm::mat4 lightSpaceTrMatrix[SHADOW_CASCADE_COUNT];
+        // view space distance where each cascade ends, w unused
+        glm::vec4 cascadeSplits;
+        // mat3 columns are padded to vec4 in std140
+        glm::vec4 lightDirMatrix[3];
+        // xyz used, w is padding
+        glm::vec4 lightDir;
+        glm::vec4 lightColor;
+        glm::vec4 pointLightPos;
+
+        void setLightDirMatrix(const glm::mat3& matrix);
+    };
+
+    // Camera and light data shared by every program through one uniform buffer on BLOCK_FRAME_DATA,
+    // written once per frame
+    class FrameUniforms
+    {
+    public:
+        FrameUniforms();
+
+        // Creates the buffer and binds it to its binding point; needs a GL context
+        void Init();
+        // Replaces the whole block with one buffer write
+        void Update(const FrameData& data);
+        void Delete();
+
+    private:
+        GLuint buffer;
+    };
+}
+
+#endif /* FrameUniforms_hpp */
@@ -0,0 +1,121 @@
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#define GPS_AVX 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    Frustum Frustum::FromMatrix(const glm::mat4& viewProjection) {
+        // rows of the column-major matrix
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        Frustum frustum;
+        frustum.planes[PLANE_LEFT] = rows[3] + rows[0];
+        frustum.planes[PLANE_RIGHT] = rows[3] - rows[0];
+        frustum.planes[PLANE_BOTTOM] = rows[3] + rows[1];
+        frustum.planes[PLANE_TOP] = rows[3] - rows[1];
+        frustum.planes[PLANE_NEAR] = rows[3] + rows[2];
+        frustum.planes[PLANE_FAR] = rows[3] - rows[2];
+        for (int i = 0; i < PLANE_COUNT; i++) {
+            float length = glm::length(glm::vec3(frustum.planes[i]));
+            if (length > 0.0f) {
+                frustum.planes[i] /= length;
+            }
+        }
+        return frustum;
+    }
+
+    Frustum Frustum::Extruded(const glm::vec3& sweep) const {
+        // the swept sphere's distance to a plane is the larger of its two ends', the far end only differs by n.sweep
+        Frustum extruded = *this;
+        for (int i = 0; i < PLANE_COUNT; i++) {
+            extruded.planes[i].w += std::max(0.0f, glm::dot(glm::vec3(planes[i]), sweep));
+        }
+        return extruded;
+    }
+
+    // a sphere is outside once its center is further than its radius behind any plane
+    static bool SphereVisible(const Frustum& frustum, float x, float y, float z, float radius) {
+        for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            if (plane.x * x + plane.y * y + plane.z * z + plane.w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t CullSpheres(const Frustum& frustum, const SphereBatch& spheres, uint8_t* visible) {
+        size_t culled = 0;
+        size_t i = 0;
+
+#ifdef GPS_AVX
+        for (; i + 8 <= spheres.count; i += 8) {
+            __m256 x = _mm256_loadu_ps(spheres.centerX + i);
+            __m256 y = _mm256_loadu_ps(spheres.centerY + i);
+            __m256 z = _mm256_loadu_ps(spheres.centerZ + i);
+            __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(spheres.radius + i));
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+                    _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+            }
+            int mask = _mm256_movemask_ps(inside);
+            for (int lane = 0; lane < 8; lane++) {
+                visible[i + lane] = (uint8_t)((mask >> lane) & 1);
+                culled += 1 - visible[i + lane];
+            }
+        }
+#endif
+
+#ifdef GPS_SSE2
+        for (; i + 4 <= spheres.count; i += 4) {
+            __m128 x = _mm_loadu_ps(spheres.centerX + i);
+            __m128 y = _mm_loadu_ps(spheres.centerY + i);
+            __m128 z = _mm_loadu_ps(spheres.centerZ + i);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(spheres.radius + i));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                    _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (int lane = 0; lane < 4; lane++) {
+                visible[i + lane] = (uint8_t)((mask >> lane) & 1);
+                culled += 1 - visible[i + lane];
+            }
+        }
+#endif
+
+        for (; i < spheres.count; i++) {
+            visible[i] = SphereVisible(frustum, spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i], spheres.radius[i]) ? 1 : 0;
+            culled += 1 - visible[i];
+        }
+        return culled;
+    }
+
+    glm::vec4 TransformSphere(const glm::mat4& transform, const glm::vec3& center, float radius) {
+        glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+        float scale = std::max(glm::length(glm::vec3(transform[0])),
+            std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+        return glm::vec4(worldCenter, radius * scale);
+    }
+}
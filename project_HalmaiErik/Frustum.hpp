@@ -0,0 +1,42 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gps {
+
+    // Six planes (xyz normal pointing inside, w distance) of a view volume, normalized
+    struct Frustum {
+        enum Plane { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR, PLANE_COUNT };
+
+        glm::vec4 planes[PLANE_COUNT];
+
+        // Planes of the volume `viewProjection` maps into the clip cube (Gribb/Hartmann)
+        static Frustum FromMatrix(const glm::mat4& viewProjection);
+
+        // Frustum grown backwards along `sweep`: a sphere passes it exactly when the sphere swept from its center
+        // to center + sweep passes every plane of this one, e.g. a shadow caster whose shadow reaches the view
+        Frustum Extruded(const glm::vec3& sweep) const;
+    };
+
+    // Bounding spheres stored as structure of arrays, so the culler tests 4 or 8 of them per instruction
+    struct SphereBatch {
+        const float* centerX;
+        const float* centerY;
+        const float* centerZ;
+        const float* radius;
+        size_t count;
+    };
+
+    // Writes 1 to visible[i] for each sphere touching the frustum, 0 for the others, and returns how many were culled.
+    // AVX tests 8 spheres at a time and SSE 4 where the compiler targets them.
+    size_t CullSpheres(const Frustum& frustum, const SphereBatch& spheres, uint8_t* visible);
+
+    // Sphere around `center`/`radius` once `transform` is applied, grown by the largest axis scale
+    glm::vec4 TransformSphere(const glm::mat4& transform, const glm::vec3& center, float radius);
+}
+
+#endif /* Frustum_hpp */
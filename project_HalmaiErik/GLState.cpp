@@ -0,0 +1,146 @@
+#include "GLState.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    GLState& GLState::getInstance() {
+        static GLState state;
+        return state;
+    }
+
+    GLState::GLState() : frameCount(0) {
+        Invalidate();
+    }
+
+    int GLState::TargetIndex(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_CUBE_MAP: return 1;
+        case GL_TEXTURE_2D_ARRAY: return 2;
+        default: return -1;
+        }
+    }
+
+    void GLState::Count(bool issued) {
+        if (issued) {
+            frame.issued++;
+        }
+        else {
+            frame.elided++;
+        }
+    }
+
+    void GLState::UseProgram(GLuint program) {
+        bool changed = this->program != program;
+        if (changed) {
+            glUseProgram(program);
+            this->program = program;
+        }
+        Count(changed);
+    }
+
+    void GLState::BindVertexArray(GLuint vertexArray) {
+        bool changed = this->vertexArray != vertexArray;
+        if (changed) {
+            glBindVertexArray(vertexArray);
+            this->vertexArray = vertexArray;
+        }
+        Count(changed);
+    }
+
+    void GLState::BindTexture(GLuint unit, GLenum target, GLuint texture) {
+        int targetIndex = TargetIndex(target);
+        if (targetIndex >= 0 && unit < MAX_TEXTURE_UNITS && textures[unit][targetIndex] == texture) {
+            Count(false);
+            return;
+        }
+
+        bool unitChanged = activeUnit != unit;
+        if (unitChanged) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        Count(unitChanged);
+
+        glBindTexture(target, texture);
+        Count(true);
+        if (targetIndex >= 0 && unit < MAX_TEXTURE_UNITS) {
+            textures[unit][targetIndex] = texture;
+        }
+    }
+
+    void GLState::SetCapability(GLenum capability, bool enabled, int& current) {
+        bool changed = current != (int)enabled;
+        if (changed) {
+            if (enabled) {
+                glEnable(capability);
+            }
+            else {
+                glDisable(capability);
+            }
+            current = enabled;
+        }
+        Count(changed);
+    }
+
+    void GLState::SetDepthTest(bool enabled) {
+        SetCapability(GL_DEPTH_TEST, enabled, depthTest);
+    }
+
+    void GLState::SetCullFace(bool enabled) {
+        SetCapability(GL_CULL_FACE, enabled, cullFace);
+    }
+
+    void GLState::SetDepthFunc(GLenum function) {
+        bool changed = depthFunc != function;
+        if (changed) {
+            glDepthFunc(function);
+            depthFunc = function;
+        }
+        Count(changed);
+    }
+
+    void GLState::SetCullMode(GLenum mode) {
+        bool changed = cullMode != mode;
+        if (changed) {
+            glCullFace(mode);
+            cullMode = mode;
+        }
+        Count(changed);
+    }
+
+    void GLState::Invalidate() {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            for (int target = 0; target < TRACKED_TARGETS; target++) {
+                textures[unit][target] = UNKNOWN;
+            }
+        }
+        depthTest = -1;
+        cullFace = -1;
+        depthFunc = GL_NONE;
+        cullMode = GL_NONE;
+    }
+
+    void GLState::EndFrame() {
+        total.issued += frame.issued;
+        total.elided += frame.elided;
+        lastFrame = frame;
+        frame = GLStateStats();
+        frameCount++;
+    }
+
+    const GLStateStats& GLState::getFrameStats() {
+        return lastFrame;
+    }
+
+    void GLState::LogStats() {
+        double frames = frameCount > 0 ? (double)frameCount : 1.0;
+        std::cout << "GL state : " << total.issued / frames << " calls issued, " << total.elided / frames
+            << " elided per frame over " << frameCount << " frames (last frame " << lastFrame.issued << " issued, "
+            << lastFrame.elided << " elided)" << std::endl;
+    }
+}
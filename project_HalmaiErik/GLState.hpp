@@ -0,0 +1,74 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+namespace gps {
+
+    // GL calls sent to the driver and skipped because the state was already set
+    struct GLStateStats {
+        uint64_t issued = 0;
+        uint64_t elided = 0;
+    };
+
+    // Shadow copy of the program, VAO, texture bindings and depth/cull state of the GL context.
+    // The draw paths change state through it so calls that would not change anything are skipped;
+    // code that changes the same state with raw GL calls must call Invalidate afterwards.
+    class GLState
+    {
+    public:
+        static GLState& getInstance();
+
+        static const int MAX_TEXTURE_UNITS = 32;
+
+        GLState();
+
+        void UseProgram(GLuint program);
+        void BindVertexArray(GLuint vertexArray);
+        // Binds `texture` to `target` of `unit`, switching the active unit only when needed
+        void BindTexture(GLuint unit, GLenum target, GLuint texture);
+
+        void SetDepthTest(bool enabled);
+        void SetDepthFunc(GLenum function);
+        void SetCullFace(bool enabled);
+        void SetCullMode(GLenum mode);
+
+        // Forgets everything, the next call of each kind is issued
+        void Invalidate();
+
+        // Closes the frame's counters, the totals keep growing
+        void EndFrame();
+        const GLStateStats& getFrameStats();
+        void LogStats();
+
+    private:
+        // 2D, cube map and 2D array bindings are tracked, other targets always go to GL
+        static const int TRACKED_TARGETS = 3;
+
+        // object names no call ever binds, used for unknown state (GL_NONE for unknown enums)
+        static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+        GLuint program;
+        GLuint vertexArray;
+        GLuint activeUnit;
+        GLuint textures[MAX_TEXTURE_UNITS][TRACKED_TARGETS];
+        // -1 unknown, otherwise 0/1
+        int depthTest;
+        int cullFace;
+        GLenum depthFunc;
+        GLenum cullMode;
+
+        GLStateStats frame;
+        GLStateStats lastFrame;
+        GLStateStats total;
+        uint64_t frameCount;
+
+        void Count(bool issued);
+        void SetCapability(GLenum capability, bool enabled, int& current);
+        static int TargetIndex(GLenum target);
+    };
+}
+
+#endif /* GLState_hpp */
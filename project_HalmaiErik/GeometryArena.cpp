@@ -0,0 +1,119 @@
+#include "GeometryArena.hpp"
+#include "InstanceBuffer.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    bool GeometryArena::enabled = true;
+
+    // enough for the scene's meshes after packing, the buffers double when they run out
+    static const GLsizeiptr INITIAL_VERTEX_BYTES = 16 * 1024 * 1024;
+    static const GLsizeiptr INITIAL_INDEX_BYTES = 8 * 1024 * 1024;
+
+    GeometryArena& GeometryArena::getInstance() {
+        static GeometryArena arena;
+        return arena;
+    }
+
+    bool GeometryArena::isMultiDrawSupported() {
+        return enabled && (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+    }
+
+    GeometryArena::GeometryArena() : vertexArray(0), vertexBuffer(0), indexBuffer(0), vertexCapacity(0), vertexUsed(0),
+        indexCapacity(0), indexUsed(0), layout(VERTEX_LAYOUT_FLOAT) {
+    }
+
+    void GeometryArena::Create(VertexLayout layout) {
+        this->layout = layout;
+        glGenVertexArrays(1, &vertexArray);
+        Grow(vertexBuffer, vertexCapacity, 0, INITIAL_VERTEX_BYTES);
+        Grow(indexBuffer, indexCapacity, 0, INITIAL_INDEX_BYTES);
+        SetupVertexArray();
+    }
+
+    void GeometryArena::Grow(GLuint& buffer, GLsizeiptr& capacity, GLsizeiptr used, GLsizeiptr required) {
+        GLsizeiptr newCapacity = std::max(capacity, (GLsizeiptr)1);
+        while (newCapacity < required) {
+            newCapacity *= 2;
+        }
+
+        // the copy targets leave the VAO's element buffer binding alone
+        GLuint newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, NULL, GL_STATIC_DRAW);
+        if (buffer != 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        buffer = newBuffer;
+        capacity = newCapacity;
+    }
+
+    void GeometryArena::SetupVertexArray() {
+        glBindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        SetupVertexAttributes(layout);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        InstanceBuffer::getInstance().SetupAttributes();
+        glBindVertexArray(0);
+    }
+
+    bool GeometryArena::Allocate(VertexLayout layout, const void* vertices, GLsizei vertexCount, GLsizei vertexSize,
+        const void* indices, GLsizei indexCount, GLenum indexType, GLint& baseVertex, GLuint& firstIndex) {
+        if (vertexArray == 0) {
+            Create(layout);
+        }
+        else if (layout != this->layout) {
+            return false;
+        }
+
+        GLsizeiptr vertexBytes = (GLsizeiptr)vertexCount * vertexSize;
+        GLsizeiptr indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        GLsizeiptr indexBytes = (GLsizeiptr)indexCount * indexSize;
+        // 16 and 32-bit ranges share the buffer, each starts on a multiple of 4 bytes so its first index is exact
+        GLsizeiptr indexOffset = (indexUsed + 3) & ~(GLsizeiptr)3;
+
+        bool grown = false;
+        if (vertexUsed + vertexBytes > vertexCapacity) {
+            Grow(vertexBuffer, vertexCapacity, vertexUsed, vertexUsed + vertexBytes);
+            grown = true;
+        }
+        if (indexOffset + indexBytes > indexCapacity) {
+            Grow(indexBuffer, indexCapacity, indexUsed, indexOffset + indexBytes);
+            grown = true;
+        }
+        if (grown) {
+            SetupVertexArray();
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertexUsed, vertexBytes, vertices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        baseVertex = (GLint)(vertexUsed / vertexSize);
+        firstIndex = (GLuint)(indexOffset / indexSize);
+        vertexUsed += vertexBytes;
+        indexUsed = indexOffset + indexBytes;
+        return true;
+    }
+
+    GLuint GeometryArena::getVertexArray() {
+        return vertexArray;
+    }
+
+    GLsizeiptr GeometryArena::getVertexBytes() {
+        return vertexUsed;
+    }
+
+    GLsizeiptr GeometryArena::getIndexBytes() {
+        return indexUsed;
+    }
+}
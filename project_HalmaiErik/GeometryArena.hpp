@@ -0,0 +1,53 @@
+#ifndef GeometryArena_hpp
+#define GeometryArena_hpp
+
+#include <GL/glew.h>
+
+#include "Mesh.hpp"
+
+namespace gps {
+
+    // One vertex buffer and one index buffer shared by every static mesh, with a single VAO reading them.
+    // Meshes are suballocated back to back and drawn with a base vertex and a first index, so any run of them
+    // can go through one glMultiDrawElementsIndirect call. Space is never given back, models live until exit.
+    class GeometryArena
+    {
+    public:
+        static GeometryArena& getInstance();
+
+        // suballocate meshes created from now on
+        static bool enabled;
+
+        // glMultiDrawElementsIndirect and a base instance to select each draw's instance data
+        static bool isMultiDrawSupported();
+
+        GeometryArena();
+
+        // Copies a mesh in, false (and nothing allocated) when the arena already holds another vertex layout.
+        // `indexType` is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT; `firstIndex` counts elements of that type.
+        bool Allocate(VertexLayout layout, const void* vertices, GLsizei vertexCount, GLsizei vertexSize,
+            const void* indices, GLsizei indexCount, GLenum indexType, GLint& baseVertex, GLuint& firstIndex);
+
+        GLuint getVertexArray();
+        GLsizeiptr getVertexBytes();
+        GLsizeiptr getIndexBytes();
+
+    private:
+        GLuint vertexArray;
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        GLsizeiptr vertexCapacity;
+        GLsizeiptr vertexUsed;
+        GLsizeiptr indexCapacity;
+        GLsizeiptr indexUsed;
+        VertexLayout layout;
+
+        void Create(VertexLayout layout);
+        // Moves `buffer` into a new store of at least `required` bytes, keeping the first `used`
+        void Grow(GLuint& buffer, GLsizeiptr& capacity, GLsizeiptr used, GLsizeiptr required);
+        // Points the VAO at the current buffers, after creating or growing them
+        void SetupVertexArray();
+    };
+}
+
+#endif /* GeometryArena_hpp */
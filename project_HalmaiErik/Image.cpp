@@ -0,0 +1,53 @@
+#include "Image.hpp"
+
+#include "stb_image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace gps {
+
+    size_t Image::getSize() const {
+        return (size_t)width * height * channels;
+    }
+
+    bool Image::isValid() const {
+        return pixels || compressed || mips;
+    }
+
+    bool DecodeImage(const char* fileName, int forceChannels, bool flipVertically, Image& image) {
+        int x, y, n;
+        unsigned char* image_data = stbi_load(fileName, &x, &y, &n, forceChannels);
+        if (!image_data) {
+            fprintf(stderr, "ERROR: could not load %s\n", fileName);
+            return false;
+        }
+
+        image.width = x;
+        image.height = y;
+        image.channels = forceChannels ? forceChannels : n;
+        image.pixels = std::shared_ptr<unsigned char>(image_data, stbi_image_free);
+
+        if (flipVertically) {
+            FlipImageRows(image);
+        }
+
+        return true;
+    }
+
+    // Swaps whole rows with memcpy through a scratch row instead of byte by byte
+    void FlipImageRows(Image& image) {
+        size_t width_in_bytes = (size_t)image.width * image.channels;
+        std::vector<unsigned char> temp(width_in_bytes);
+        int half_height = image.height / 2;
+
+        for (int row = 0; row < half_height; row++) {
+            unsigned char* top = image.pixels.get() + row * width_in_bytes;
+            unsigned char* bottom = image.pixels.get() + (image.height - row - 1) * width_in_bytes;
+            memcpy(temp.data(), top, width_in_bytes);
+            memcpy(top, bottom, width_in_bytes);
+            memcpy(bottom, temp.data(), width_in_bytes);
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef Image_hpp
+#define Image_hpp
+
+#include <memory>
+#include <string>
+
+namespace gps {
+
+    struct CompressedImage;
+    struct MipChain;
+
+    // Decoded pixel data, ready to be uploaded with glTexImage2D
+    struct Image {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::shared_ptr<unsigned char> pixels;
+        // set instead of `pixels` when the decoder block compressed the image
+        std::shared_ptr<CompressedImage> compressed;
+        // set instead of `pixels` when the decoder built the mip levels
+        std::shared_ptr<MipChain> mips;
+
+        size_t getSize() const;
+        bool isValid() const;
+    };
+
+    // Decodes an image file with stb_image; does not touch any GL state, so it is safe on worker threads
+    bool DecodeImage(const char* fileName, int forceChannels, bool flipVertically, Image& image);
+
+    // Swaps the rows of the image so the first row is the bottom one, as OpenGL expects
+    void FlipImageRows(Image& image);
+}
+
+#endif /* Image_hpp */
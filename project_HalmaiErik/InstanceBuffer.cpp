@@ -0,0 +1,86 @@
+#include "InstanceBuffer.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    // room for a few hundred instances before the first resize, so the VAOs never point at an empty store
+    static const GLsizei INITIAL_INSTANCE_CAPACITY = 256;
+
+    InstanceData InstanceData::FromModel(const glm::mat4& model, const glm::vec3& positionScale, const glm::vec3& positionOffset) {
+        InstanceData instance;
+        instance.model = model;
+        glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(model));
+        for (int i = 0; i < 3; i++) {
+            instance.normalMatrix[i] = glm::vec4(normalMatrix[i], 0.0f);
+        }
+        instance.positionScale = glm::vec4(positionScale, 0.0f);
+        instance.positionOffset = glm::vec4(positionOffset, 0.0f);
+        return instance;
+    }
+
+    InstanceBuffer& InstanceBuffer::getInstance() {
+        static InstanceBuffer instanceBuffer;
+        return instanceBuffer;
+    }
+
+    InstanceBuffer::InstanceBuffer() : buffer(0), capacity(0) {
+    }
+
+    void InstanceBuffer::Reserve(GLsizei count) {
+        if (buffer == 0) {
+            glGenBuffers(1, &buffer);
+        }
+        if (count > capacity) {
+            capacity = count;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+    }
+
+    void InstanceBuffer::SetupAttributes() {
+        if (buffer == 0) {
+            Reserve(INITIAL_INSTANCE_CAPACITY);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+        for (GLuint column = 0; column < 4; column++) {
+            GLuint attribute = FIRST_ATTRIBUTE + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (GLvoid*)(offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        for (GLuint column = 0; column < 3; column++) {
+            GLuint attribute = FIRST_ATTRIBUTE + 4 + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (GLvoid*)(offsetof(InstanceData, normalMatrix) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        GLuint decodeAttribute = FIRST_ATTRIBUTE + 7;
+        glEnableVertexAttribArray(decodeAttribute);
+        glVertexAttribPointer(decodeAttribute, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)offsetof(InstanceData, positionScale));
+        glVertexAttribDivisor(decodeAttribute, 1);
+        glEnableVertexAttribArray(decodeAttribute + 1);
+        glVertexAttribPointer(decodeAttribute + 1, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)offsetof(InstanceData, positionOffset));
+        glVertexAttribDivisor(decodeAttribute + 1, 1);
+    }
+
+    void InstanceBuffer::Upload(const glm::mat4* models, GLsizei count, const glm::vec3& positionScale, const glm::vec3& positionOffset) {
+        staging.resize(count);
+        for (GLsizei i = 0; i < count; i++) {
+            staging[i] = InstanceData::FromModel(models[i], positionScale, positionOffset);
+        }
+        Upload(staging.data(), count);
+    }
+
+    void InstanceBuffer::Upload(const InstanceData* instances, GLsizei count) {
+        // Reserve orphans the store, growing it when needed
+        Reserve(count);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceData), instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef InstanceBuffer_hpp
+#define InstanceBuffer_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Per instance vertex data of the instanced shaders
+    struct InstanceData {
+        glm::mat4 model;
+        // inverse transpose of the model's upper 3x3, columns padded to vec4
+        glm::vec4 normalMatrix[3];
+        // position decode of the mesh drawn (Mesh::getPositionScale/getPositionOffset), w unused
+        glm::vec4 positionScale;
+        glm::vec4 positionOffset;
+
+        static InstanceData FromModel(const glm::mat4& model, const glm::vec3& positionScale, const glm::vec3& positionOffset);
+    };
+
+    // Streaming vertex buffer with the transforms of the instances being drawn. Every mesh VAO reads it
+    // through attributes FIRST_ATTRIBUTE.. with a divisor of 1, so an upload is all an instanced draw needs;
+    // indirect draws pick their range of it with their base instance.
+    class InstanceBuffer
+    {
+    public:
+        static InstanceBuffer& getInstance();
+
+        // model matrix columns in 3..6, normal matrix columns in 7..9, position decode in 10 and 11
+        static const GLuint FIRST_ATTRIBUTE = 3;
+        static const GLuint ATTRIBUTE_COUNT = 9;
+
+        InstanceBuffer();
+
+        // Points the instance attributes of the bound VAO at the buffer, created on first use
+        void SetupAttributes();
+
+        // Replaces the buffer contents with `count` instances; the store is orphaned first so the draws
+        // still reading the previous instances never stall the upload
+        void Upload(const glm::mat4* models, GLsizei count, const glm::vec3& positionScale, const glm::vec3& positionOffset);
+        void Upload(const InstanceData* instances, GLsizei count);
+
+    private:
+        GLuint buffer;
+        GLsizei capacity;
+        std::vector<InstanceData> staging;
+
+        void Reserve(GLsizei count);
+    };
+}
+
+#endif /* InstanceBuffer_hpp */
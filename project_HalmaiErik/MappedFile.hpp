@@ -0,0 +1,42 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+    // Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Maps the file into memory, returns false if it cannot be opened or is empty
+        bool Open(const std::string& fileName);
+        void Close();
+
+        const unsigned char* getData() const;
+        size_t getSize() const;
+
+    private:
+        const unsigned char* data;
+        size_t size;
+#ifdef _WIN32
+        void* fileHandle;
+        void* mappingHandle;
+#else
+        int fileDescriptor;
+#endif
+    };
+
+    // 64-bit FNV-1a hash of a block of memory
+    uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+}
+
+#endif /* MappedFile_hpp */
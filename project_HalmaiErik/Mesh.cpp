@@ -1,47 +1,302 @@
 #include "Mesh.hpp"
+#include "GeometryArena.hpp"
+#include "GLState.hpp"
+#include "InstanceBuffer.hpp"
+
+#include "glm/gtc/packing.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cmath>
+
 namespace gps {
 
+	VertexLayout Mesh::vertexLayout = VERTEX_LAYOUT_PACKED;
+
+	// ambient, diffuse and specular; the units after them belong to the scene (shadow map)
+	static const GLuint MATERIAL_TEXTURE_UNITS = 3;
+
+	Bounds ComputeBounds(const std::vector<Vertex>& vertices) {
+		Bounds bounds;
+		bounds.min = bounds.max = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+		for (size_t i = 1; i < vertices.size(); i++) {
+			bounds.min = glm::min(bounds.min, vertices[i].Position);
+			bounds.max = glm::max(bounds.max, vertices[i].Position);
+		}
+		ComputeBoundingSphere(vertices.data(), vertices.size(), bounds);
+		return bounds;
+	}
+
+	void ComputeBoundingSphere(const Vertex* vertices, size_t vertexCount, Bounds& bounds) {
+		bounds.center = (bounds.min + bounds.max) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++) {
+			glm::vec3 offset = vertices[i].Position - bounds.center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		bounds.radius = sqrtf(radiusSquared);
+	}
+
+	static GLushort QuantizeUnorm16(float value, float min, float max) {
+		float extent = max - min;
+		float normalized = extent > 0.0f ? (value - min) / extent : 0.0f;
+		return (GLushort)std::lround(glm::clamp(normalized, 0.0f, 1.0f) * 65535.0f);
+	}
+
+	static GLshort QuantizeSnorm16(float value) {
+		return (GLshort)std::lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+	}
+
+	PackedVertex PackVertex(const Vertex& vertex, const Bounds& bounds) {
+		PackedVertex packed;
+		for (int c = 0; c < 3; c++) {
+			packed.position[c] = QuantizeUnorm16(vertex.Position[c], bounds.min[c], bounds.max[c]);
+		}
+		packed.position[3] = 0;
+
+		// octahedral mapping: project on the |x|+|y|+|z| = 1 octahedron and fold the lower half over the upper one
+		glm::vec3 normal = vertex.Normal;
+		float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+		float x = sum > 0.0f ? normal.x / sum : 0.0f;
+		float y = sum > 0.0f ? normal.y / sum : 0.0f;
+		if (normal.z < 0.0f) {
+			float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = foldedX;
+			y = foldedY;
+		}
+		packed.normal[0] = QuantizeSnorm16(x);
+		packed.normal[1] = QuantizeSnorm16(y);
+
+		packed.texCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+		packed.texCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+		return packed;
+	}
+
+	PackedGeometry PackGeometry(const Vertex* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount,
+		const Bounds& bounds, VertexLayout layout, PackedStorage& storage) {
+		PackedGeometry geometry;
+		geometry.layout = layout;
+		geometry.vertexCount = vertexCount;
+		geometry.indexCount = indexCount;
+
+		if (layout == VERTEX_LAYOUT_PACKED) {
+			storage.vertices.resize(vertexCount);
+			for (GLsizei i = 0; i < vertexCount; i++) {
+				storage.vertices[i] = PackVertex(vertices[i], bounds);
+			}
+			geometry.vertices = storage.vertices.data();
+			geometry.positionScale = bounds.max - bounds.min;
+			geometry.positionOffset = bounds.min;
+		}
+		else {
+			geometry.vertices = vertices;
+			geometry.positionScale = glm::vec3(1.0f);
+			geometry.positionOffset = glm::vec3(0.0f);
+		}
+
+		// 16-bit indices whenever every vertex is reachable with them
+		if (vertexCount <= 65536) {
+			storage.indices.assign(indices, indices + indexCount);
+			geometry.indices = storage.indices.data();
+			geometry.indexType = GL_UNSIGNED_SHORT;
+		}
+		else {
+			geometry.indices = indices;
+			geometry.indexType = GL_UNSIGNED_INT;
+		}
+		return geometry;
+	}
+
+	GLsizei VertexSize(VertexLayout layout) {
+		return layout == VERTEX_LAYOUT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+	}
+
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, std::vector<SubMesh> subMeshes)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->vertexCount = (GLsizei)this->vertices.size();
+		this->indexCount = (GLsizei)this->indices.size();
+
+		this->bounds = ComputeBounds(this->vertices);
+		this->setSubMeshes(subMeshes);
+
+		PackedStorage storage;
+		this->setupMesh(PackGeometry(this->vertices.data(), this->vertexCount, this->indices.data(), this->indexCount,
+			this->bounds, vertexLayout, storage));
+	}
+
+	Mesh::Mesh(const PackedGeometry& geometry, Bounds bounds, std::vector<Texture> textures, std::vector<SubMesh> subMeshes)
+	{
+		this->textures = textures;
+		this->bounds = bounds;
+		this->vertexCount = geometry.vertexCount;
+		this->indexCount = geometry.indexCount;
+		this->setSubMeshes(subMeshes);
+
+		this->setupMesh(geometry);
+	}
+
+	void Mesh::setSubMeshes(std::vector<SubMesh> subMeshes) {
+		if (subMeshes.empty()) {
+			SubMesh whole;
+			whole.firstIndex = 0;
+			whole.indexCount = this->indexCount;
+			whole.bounds = this->bounds;
+			subMeshes.push_back(whole);
+		}
+		this->subMeshes = subMeshes;
+	}
 
-		this->setupMesh();
+	GLsizeiptr IndexSize(GLenum indexType) {
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
 	}
 
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
+	bool Mesh::isInArena() {
+		return this->inArena;
+	}
+
+	GLenum Mesh::getIndexType() {
+		return this->indexType;
+	}
+
+	GLuint Mesh::getFirstIndex() {
+		return this->firstIndex;
+	}
+
+	GLint Mesh::getBaseVertex() {
+		return this->baseVertex;
+	}
+
+	glm::vec3 Mesh::getPositionScale() {
+		return this->positionScale;
+	}
+
+	glm::vec3 Mesh::getPositionOffset() {
+		return this->positionOffset;
+	}
+
+	bool Mesh::hasTexture(const std::string& type) const {
+		for (const Texture& texture : textures) {
+			if (texture.type == type) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	GLsizei Mesh::getVertexCount() {
+		return this->vertexCount;
+	}
+
+	GLsizei Mesh::getIndexCount() {
+		return this->indexCount;
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(const gps::Shader& shader)
 	{
+		this->Bind(shader);
+		glDrawElementsBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+			(GLvoid*)((size_t)this->firstIndex * IndexSize(this->indexType)), this->baseVertex);
+	}
+
+	// Draws `instanceCount` copies, each reading its transform from the InstanceBuffer
+	void Mesh::DrawInstanced(const gps::Shader& shader, GLsizei instanceCount)
+	{
+		this->Bind(shader);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+			(GLvoid*)((size_t)this->firstIndex * IndexSize(this->indexType)), instanceCount, this->baseVertex);
+	}
+
+	void Mesh::Bind(const gps::Shader& shader)
+	{
+		GLState& state = GLState::getInstance();
 		shader.useShaderProgram();
 
-		//set textures
+		//set textures, they stay bound until another draw needs the unit
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			if (this->textureUniforms[i] != UNIFORM_COUNT) {
+				shader.setInt(this->textureUniforms[i], i);
+			}
+			state.BindTexture(i, GL_TEXTURE_2D, this->textures[i].id);
+		}
+		// samplers this mesh has no texture for keep reading black, as if the material units were unbound after each draw
+		for (GLuint i = (GLuint)textures.size(); i < MATERIAL_TEXTURE_UNITS; i++)
+		{
+			state.BindTexture(i, GL_TEXTURE_2D, 0);
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		// how the vertex shader decodes this mesh's layout
+		shader.setVec3(UNIFORM_POSITION_SCALE, this->positionScale);
+		shader.setVec3(UNIFORM_POSITION_OFFSET, this->positionOffset);
+		shader.setInt(UNIFORM_OCTAHEDRAL_NORMALS, this->layout == VERTEX_LAYOUT_PACKED);
 
+		state.BindVertexArray(this->buffers.VAO);
     }
 
+	void SetupVertexAttributes(VertexLayout layout) {
+		if (layout == VERTEX_LAYOUT_PACKED) {
+			// Vertex Positions, [0, 1] inside the bounds
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, position));
+			// Vertex Normals, octahedral [-1, 1]^2
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, texCoords));
+		}
+		else {
+			// Vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		}
+	}
+
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
+	void Mesh::setupMesh(const PackedGeometry& geometry){
+		// the sampler a texture binds to only depends on its type
+		this->textureUniforms.clear();
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			this->textureUniforms.push_back(Shader::findStandardUniform(this->textures[i].type));
+		}
+
+		this->layout = geometry.layout;
+		this->indexType = geometry.indexType;
+		this->positionScale = geometry.positionScale;
+		this->positionOffset = geometry.positionOffset;
+		const void* gpuVertices = geometry.vertices;
+		const void* gpuIndices = geometry.indices;
+		GLsizei vertexSize = VertexSize(this->layout);
+
+		if (GeometryArena::enabled && GeometryArena::getInstance().Allocate(this->layout, gpuVertices, this->vertexCount, vertexSize,
+			gpuIndices, this->indexCount, this->indexType, this->baseVertex, this->firstIndex)) {
+			this->inArena = true;
+			this->buffers.VAO = GeometryArena::getInstance().getVertexArray();
+			this->buffers.VBO = 0;
+			this->buffers.EBO = 0;
+			return;
+		}
+
+		this->inArena = false;
+		this->baseVertex = 0;
+		this->firstIndex = 0;
+
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
@@ -50,21 +305,15 @@ namespace gps {
 		glBindVertexArray(this->buffers.VAO);
 		// Load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)this->vertexCount * vertexSize, gpuVertices, GL_STATIC_DRAW);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)this->indexCount * IndexSize(this->indexType), gpuIndices, GL_STATIC_DRAW);
 
 		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		SetupVertexAttributes(this->layout);
+		// per instance transforms, only read by the instanced shaders
+		InstanceBuffer::getInstance().SetupAttributes();
 
 		glBindVertexArray(0);
 	}
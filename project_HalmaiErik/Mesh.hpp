@@ -34,6 +34,87 @@ struct Material
         glm::vec3 specular;
     };
 
+// Axis-aligned bounding box and bounding sphere in model space
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+    // sphere around the box center reaching the farthest vertex, tighter than the box's half diagonal
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+};
+
+// Range of a mesh's index buffer that came from one .obj shape, kept for culling after merging
+struct SubMesh {
+    GLuint firstIndex;
+    GLsizei indexCount;
+    Bounds bounds;
+};
+
+// CPU-side geometry of one mesh, filled in by the loaders before any GL call
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    // only type and path are known until the textures get uploaded
+    std::vector<Texture> textures;
+    Bounds bounds;
+    // empty until shapes are merged
+    std::vector<SubMesh> subMeshes;
+};
+
+Bounds ComputeBounds(const std::vector<Vertex>& vertices);
+// Fills the sphere of `bounds` from its box and the vertices it encloses
+void ComputeBoundingSphere(const Vertex* vertices, size_t vertexCount, Bounds& bounds);
+
+// GPU vertex formats Mesh::setupMesh can upload
+enum VertexLayout {
+    // Vertex as is, 32 bytes
+    VERTEX_LAYOUT_FLOAT,
+    // PackedVertex, 16 bytes
+    VERTEX_LAYOUT_PACKED
+};
+
+// Position quantized to unorm16 inside the mesh bounds, octahedral snorm16 normal, half float texture coordinates
+struct PackedVertex {
+    GLushort position[4];
+    GLshort normal[2];
+    GLhalf texCoords[2];
+};
+
+PackedVertex PackVertex(const Vertex& vertex, const Bounds& bounds);
+
+// Vertices and indices in the layout the GPU reads, as Mesh uploads them and the mesh cache stores them
+struct PackedGeometry {
+    VertexLayout layout;
+    const void* vertices;
+    GLsizei vertexCount;
+    // GL_UNSIGNED_SHORT whenever every index fits
+    GLenum indexType;
+    const void* indices;
+    GLsizei indexCount;
+    // decode of the quantized positions: position = positionOffset + stored * positionScale
+    glm::vec3 positionScale;
+    glm::vec3 positionOffset;
+};
+
+// Storage of whatever PackGeometry had to convert, the rest points at its input
+struct PackedStorage {
+    std::vector<PackedVertex> vertices;
+    std::vector<GLushort> indices;
+};
+
+// Converts float vertices and 32-bit indices to `layout` and the smallest index type
+PackedGeometry PackGeometry(const Vertex* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount,
+    const Bounds& bounds, VertexLayout layout, PackedStorage& storage);
+
+// Bytes of one `layout` vertex
+GLsizei VertexSize(VertexLayout layout);
+
+// Attributes 0..2 of the bound VAO, reading `layout` vertices from the bound GL_ARRAY_BUFFER
+void SetupVertexAttributes(VertexLayout layout);
+
+// Bytes of one GL_UNSIGNED_SHORT or GL_UNSIGNED_INT index
+GLsizeiptr IndexSize(GLenum indexType);
+
 struct Buffers {
     GLuint VAO;
     GLuint VBO;
@@ -46,19 +127,64 @@ public:
     std::vector<Vertex> vertices;
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
+    Bounds bounds;
+    // always at least one range, covering the whole index buffer when nothing was merged
+    std::vector<SubMesh> subMeshes;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	// Layout used by meshes created from now on
+	static VertexLayout vertexLayout;
 
-	Buffers getBuffers();
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+		std::vector<SubMesh> subMeshes = std::vector<SubMesh>());
+
+	// Uploads already packed data owned by someone else (e.g. a mapped mesh cache) as is, without keeping a CPU copy.
+	// `bounds` must come with its sphere.
+	Mesh(const PackedGeometry& geometry, Bounds bounds, std::vector<Texture> textures,
+		std::vector<SubMesh> subMeshes = std::vector<SubMesh>());
 
-	void Draw(gps::Shader shader);
+	// VBO and EBO are 0 for meshes suballocated from the GeometryArena, whose VAO they share
+	Buffers getBuffers();
+	bool isInArena();
+	GLenum getIndexType();
+	// where the mesh starts in its buffers: firstIndex in elements of getIndexType(), baseVertex added to every index
+	GLuint getFirstIndex();
+	GLint getBaseVertex();
+	glm::vec3 getPositionScale();
+	glm::vec3 getPositionOffset();
+	GLsizei getVertexCount();
+	GLsizei getIndexCount();
+	// whether the material has a texture of `type` ("diffuseTexture", "specularTexture", ...)
+	bool hasTexture(const std::string& type) const;
+
+	void Draw(const gps::Shader& shader);
+	// One glDrawElementsInstanced over the transforms last uploaded to the InstanceBuffer
+	void DrawInstanced(const gps::Shader& shader, GLsizei instanceCount);
+
+	// Textures, decode uniforms and VAO of a draw, for callers that issue the draw call themselves
+	void Bind(const gps::Shader& shader);
 
 private:
     /*  Render data  */
     Buffers buffers;
+    GLsizei vertexCount;
+    GLsizei indexCount;
+
+    VertexLayout layout;
+    // GL_UNSIGNED_SHORT whenever every index fits
+    GLenum indexType;
+    bool inArena;
+    GLuint firstIndex;
+    GLint baseVertex;
+    // decode of the quantized positions: position = positionOffset + stored * positionScale
+    glm::vec3 positionScale;
+    glm::vec3 positionOffset;
+    // sampler uniform of each texture, from its type
+    std::vector<StandardUniform> textureUniforms;
+
+	void setSubMeshes(std::vector<SubMesh> subMeshes);
 
 	// Initializes all the buffer objects/arrays
-	void setupMesh();
+	void setupMesh(const PackedGeometry& geometry);
 
 };
 
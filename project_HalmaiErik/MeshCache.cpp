@@ -0,0 +1,351 @@
+#include "MeshCache.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    static const char MESH_CACHE_MAGIC[8] = { 'G', 'P', 'S', 'M', 'E', 'S', 'H', '\0' };
+
+    static uint64_t AlignOffset(uint64_t offset) {
+        return (offset + 15) & ~(uint64_t)15;
+    }
+
+    std::string MeshCache::CachePath(std::string objFileName) {
+        return objFileName + ".meshcache";
+    }
+
+    // Fills the source part of a header with the current size/mtime (and optionally hash) of the .obj
+    bool MeshCache::ReadSourceStamp(std::string objFileName, bool withHash, MeshCacheHeader& stamp) {
+        std::error_code error;
+        std::filesystem::path sourcePath(objFileName);
+
+        uintmax_t size = std::filesystem::file_size(sourcePath, error);
+        if (error) {
+            return false;
+        }
+        auto time = std::filesystem::last_write_time(sourcePath, error);
+        if (error) {
+            return false;
+        }
+
+        stamp.sourceSize = (uint64_t)size;
+        stamp.sourceTime = (uint64_t)time.time_since_epoch().count();
+        stamp.sourceHash = 0;
+
+        if (withHash) {
+            MappedFile source;
+            if (!source.Open(objFileName)) {
+                return false;
+            }
+            stamp.sourceHash = HashBytes(source.getData(), source.getSize());
+        }
+
+        return true;
+    }
+
+    // Stores a new source mtime in the header of an existing cache file
+    static bool WriteSourceTime(const std::string& cachePath, uint64_t sourceTime) {
+        std::fstream out(cachePath, std::ios::in | std::ios::out | std::ios::binary);
+        out.seekp(offsetof(MeshCacheHeader, sourceTime));
+        out.write((const char*)&sourceTime, sizeof(sourceTime));
+        return (bool)out;
+    }
+
+    static void StoreVec3(float* stored, const glm::vec3& value) {
+        for (int c = 0; c < 3; c++) {
+            stored[c] = value[c];
+        }
+    }
+
+    static glm::vec3 LoadVec3(const float* stored) {
+        return glm::vec3(stored[0], stored[1], stored[2]);
+    }
+
+    static void StoreBounds(const Bounds& bounds, float* min, float* max, float* center, float& radius) {
+        StoreVec3(min, bounds.min);
+        StoreVec3(max, bounds.max);
+        StoreVec3(center, bounds.center);
+        radius = bounds.radius;
+    }
+
+    static Bounds LoadBounds(const float* min, const float* max, const float* center, float radius) {
+        Bounds bounds;
+        bounds.min = LoadVec3(min);
+        bounds.max = LoadVec3(max);
+        bounds.center = LoadVec3(center);
+        bounds.radius = radius;
+        return bounds;
+    }
+
+    bool MeshCache::Open(std::string objFileName, uint64_t settingsKey, VertexLayout layout) {
+        Close();
+
+        std::string cachePath = CachePath(objFileName);
+        if (!file.Open(cachePath)) {
+            return false;
+        }
+
+        if (!Validate()) {
+            std::cerr << "WARNING: ignoring corrupt mesh cache " << cachePath << std::endl;
+            Close();
+            return false;
+        }
+
+        // the size/mtime pair is the fast path, the content hash catches touched but unchanged files
+        MeshCacheHeader source = {};
+        if (!ReadSourceStamp(objFileName, false, source)) {
+            std::cout << "Mesh cache is stale : " << cachePath << std::endl;
+            Close();
+            return false;
+        }
+        bool fresh = source.sourceSize == header->sourceSize && source.sourceTime == header->sourceTime;
+        bool touched = false;
+        if (!fresh && source.sourceSize == header->sourceSize) {
+            fresh = ReadSourceStamp(objFileName, true, source) && source.sourceHash == header->sourceHash;
+            touched = fresh;
+        }
+
+        if (!fresh || header->settingsKey != settingsKey || header->vertexLayout != (uint32_t)layout) {
+            std::cout << "Mesh cache is stale : " << cachePath << std::endl;
+            Close();
+            return false;
+        }
+
+        // same content under a new mtime: store the new stamp so the next launch takes the fast path again
+        if (touched) {
+            Close();
+            if (!WriteSourceTime(cachePath, source.sourceTime)) {
+                std::cerr << "WARNING: could not update mesh cache stamp " << cachePath << std::endl;
+            }
+            if (!file.Open(cachePath) || !Validate()) {
+                Close();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Checks that every offset in the mapped file stays inside it
+    bool MeshCache::Validate() {
+        size_t size = file.getSize();
+        const unsigned char* data = file.getData();
+
+        if (size < sizeof(MeshCacheHeader)) {
+            return false;
+        }
+        header = (const MeshCacheHeader*)data;
+        if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 || header->version != VERSION ||
+            (header->vertexLayout != VERTEX_LAYOUT_FLOAT && header->vertexLayout != VERTEX_LAYOUT_PACKED)) {
+            return false;
+        }
+        uint64_t vertexSize = (uint64_t)VertexSize((VertexLayout)header->vertexLayout);
+        if (sizeof(MeshCacheHeader) + (uint64_t)header->meshCount * sizeof(MeshCacheEntry) > size) {
+            return false;
+        }
+        entries = (const MeshCacheEntry*)(data + sizeof(MeshCacheHeader));
+
+        for (uint32_t i = 0; i < header->meshCount; i++) {
+            const MeshCacheEntry& entry = entries[i];
+            if (entry.indexType != GL_UNSIGNED_SHORT && entry.indexType != GL_UNSIGNED_INT) {
+                return false;
+            }
+            if (entry.vertexOffset % 16 != 0 || entry.indexOffset % 16 != 0 ||
+                entry.vertexOffset + (uint64_t)entry.vertexCount * vertexSize > size ||
+                entry.indexOffset + (uint64_t)entry.indexCount * IndexSize(entry.indexType) > size ||
+                entry.subMeshOffset % sizeof(uint32_t) != 0 ||
+                entry.subMeshOffset + (uint64_t)entry.subMeshCount * sizeof(MeshCacheSubMesh) > size) {
+                return false;
+            }
+
+            uint64_t offset = entry.textureOffset;
+            for (uint32_t t = 0; t < entry.textureCount; t++) {
+                if (offset + 2 * sizeof(uint32_t) > size) {
+                    return false;
+                }
+                uint32_t lengths[2];
+                memcpy(lengths, data + offset, sizeof(lengths));
+                offset += sizeof(lengths) + (uint64_t)lengths[0] + lengths[1];
+                if (offset > size) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void MeshCache::Close() {
+        file.Close();
+        header = nullptr;
+        entries = nullptr;
+    }
+
+    size_t MeshCache::getMeshCount() {
+        return header ? header->meshCount : 0;
+    }
+
+    PackedGeometry MeshCache::getGeometry(size_t mesh) {
+        const MeshCacheEntry& entry = entries[mesh];
+        PackedGeometry geometry;
+        geometry.layout = (VertexLayout)header->vertexLayout;
+        geometry.vertices = file.getData() + entry.vertexOffset;
+        geometry.vertexCount = (GLsizei)entry.vertexCount;
+        geometry.indexType = (GLenum)entry.indexType;
+        geometry.indices = file.getData() + entry.indexOffset;
+        geometry.indexCount = (GLsizei)entry.indexCount;
+        geometry.positionScale = LoadVec3(entry.positionScale);
+        geometry.positionOffset = LoadVec3(entry.positionOffset);
+        return geometry;
+    }
+
+    Bounds MeshCache::getBounds(size_t mesh) {
+        const MeshCacheEntry& entry = entries[mesh];
+        return LoadBounds(entry.boundsMin, entry.boundsMax, entry.boundsCenter, entry.boundsRadius);
+    }
+
+    std::vector<SubMesh> MeshCache::getSubMeshes(size_t mesh) {
+        std::vector<SubMesh> subMeshes(entries[mesh].subMeshCount);
+        const MeshCacheSubMesh* stored = (const MeshCacheSubMesh*)(file.getData() + entries[mesh].subMeshOffset);
+        for (size_t i = 0; i < subMeshes.size(); i++) {
+            subMeshes[i].firstIndex = stored[i].firstIndex;
+            subMeshes[i].indexCount = (GLsizei)stored[i].indexCount;
+            subMeshes[i].bounds = LoadBounds(stored[i].boundsMin, stored[i].boundsMax, stored[i].boundsCenter,
+                stored[i].boundsRadius);
+        }
+        return subMeshes;
+    }
+
+    std::vector<Texture> MeshCache::getTextures(size_t mesh) {
+        std::vector<Texture> textures;
+        const unsigned char* cursor = file.getData() + entries[mesh].textureOffset;
+
+        for (uint32_t t = 0; t < entries[mesh].textureCount; t++) {
+            uint32_t lengths[2];
+            memcpy(lengths, cursor, sizeof(lengths));
+            cursor += sizeof(lengths);
+
+            Texture texture;
+            texture.id = 0;
+            texture.type = std::string((const char*)cursor, lengths[0]);
+            cursor += lengths[0];
+            texture.path = std::string((const char*)cursor, lengths[1]);
+            cursor += lengths[1];
+            textures.push_back(texture);
+        }
+
+        return textures;
+    }
+
+    bool MeshCache::Write(std::string objFileName, const std::vector<MeshData>& meshes, uint64_t settingsKey,
+        VertexLayout layout) {
+        MeshCacheHeader header = {};
+        memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+        header.version = VERSION;
+        header.meshCount = (uint32_t)meshes.size();
+        header.settingsKey = settingsKey;
+        header.vertexLayout = (uint32_t)layout;
+        if (!ReadSourceStamp(objFileName, true, header)) {
+            return false;
+        }
+
+        // lay out the sub-meshes and texture references first, then the aligned geometry
+        std::vector<MeshCacheEntry> entries(meshes.size());
+        std::vector<MeshCacheSubMesh> subMeshes;
+        uint64_t offset = sizeof(MeshCacheHeader) + meshes.size() * sizeof(MeshCacheEntry);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            entries[i].subMeshOffset = offset + subMeshes.size() * sizeof(MeshCacheSubMesh);
+            entries[i].subMeshCount = (uint32_t)meshes[i].subMeshes.size();
+            for (size_t s = 0; s < meshes[i].subMeshes.size(); s++) {
+                const SubMesh& subMesh = meshes[i].subMeshes[s];
+                MeshCacheSubMesh stored;
+                stored.firstIndex = subMesh.firstIndex;
+                stored.indexCount = (uint32_t)subMesh.indexCount;
+                StoreBounds(subMesh.bounds, stored.boundsMin, stored.boundsMax, stored.boundsCenter, stored.boundsRadius);
+                subMeshes.push_back(stored);
+            }
+        }
+        offset += subMeshes.size() * sizeof(MeshCacheSubMesh);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            entries[i].textureOffset = offset;
+            entries[i].textureCount = (uint32_t)meshes[i].textures.size();
+            for (size_t t = 0; t < meshes[i].textures.size(); t++) {
+                offset += 2 * sizeof(uint32_t) + meshes[i].textures[t].type.size() + meshes[i].textures[t].path.size();
+            }
+        }
+        // packed exactly as Mesh packs the parsed vertices, so a hit uploads the mapped bytes as they are
+        std::vector<PackedStorage> storage(meshes.size());
+        std::vector<PackedGeometry> geometry(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const MeshData& mesh = meshes[i];
+            Bounds bounds = ComputeBounds(mesh.vertices);
+            geometry[i] = PackGeometry(mesh.vertices.data(), (GLsizei)mesh.vertices.size(), mesh.indices.data(),
+                (GLsizei)mesh.indices.size(), bounds, layout, storage[i]);
+
+            entries[i].vertexCount = (uint32_t)geometry[i].vertexCount;
+            entries[i].indexCount = (uint32_t)geometry[i].indexCount;
+            entries[i].indexType = (uint32_t)geometry[i].indexType;
+            entries[i].vertexOffset = offset = AlignOffset(offset);
+            offset += (uint64_t)geometry[i].vertexCount * VertexSize(layout);
+            entries[i].indexOffset = offset = AlignOffset(offset);
+            offset += (uint64_t)geometry[i].indexCount * IndexSize(geometry[i].indexType);
+            StoreBounds(bounds, entries[i].boundsMin, entries[i].boundsMax, entries[i].boundsCenter, entries[i].boundsRadius);
+            StoreVec3(entries[i].positionScale, geometry[i].positionScale);
+            StoreVec3(entries[i].positionOffset, geometry[i].positionOffset);
+        }
+
+        // write to a temporary file first so a crash never leaves a half written cache behind
+        std::string cachePath = CachePath(objFileName);
+        std::string tempPath = cachePath + ".tmp";
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write mesh cache " << cachePath << std::endl;
+            return false;
+        }
+
+        static const char zeros[16] = { 0 };
+        uint64_t written = 0;
+        auto write = [&](const void* data, uint64_t size) {
+            out.write((const char*)data, (std::streamsize)size);
+            written += size;
+        };
+        auto pad = [&](uint64_t target) {
+            write(zeros, target - written);
+        };
+
+        write(&header, sizeof(header));
+        write(entries.data(), entries.size() * sizeof(MeshCacheEntry));
+        write(subMeshes.data(), subMeshes.size() * sizeof(MeshCacheSubMesh));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            for (size_t t = 0; t < meshes[i].textures.size(); t++) {
+                const Texture& texture = meshes[i].textures[t];
+                uint32_t lengths[2] = { (uint32_t)texture.type.size(), (uint32_t)texture.path.size() };
+                write(lengths, sizeof(lengths));
+                write(texture.type.data(), lengths[0]);
+                write(texture.path.data(), lengths[1]);
+            }
+        }
+        for (size_t i = 0; i < meshes.size(); i++) {
+            pad(entries[i].vertexOffset);
+            write(geometry[i].vertices, (uint64_t)geometry[i].vertexCount * VertexSize(layout));
+            pad(entries[i].indexOffset);
+            write(geometry[i].indices, (uint64_t)geometry[i].indexCount * IndexSize(geometry[i].indexType));
+        }
+        out.close();
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, cachePath, error);
+        if (!out || error) {
+            std::cerr << "WARNING: could not write mesh cache " << cachePath << std::endl;
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+
+        std::cout << "Wrote mesh cache : " << cachePath << std::endl;
+        return true;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // On-disk layout of a .meshcache file:
+    // header | entry[meshCount] | sub-meshes | texture references | 16-byte aligned vertex and index data,
+    // already in the vertex layout and index type Mesh uploads
+    struct MeshCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t meshCount;
+        // identifies the .obj the cache was built from
+        uint64_t sourceTime;
+        uint64_t sourceSize;
+        uint64_t sourceHash;
+        // MeshOptimizerSettings::getKey of the processing applied to the meshes
+        uint64_t settingsKey;
+        // VertexLayout of every mesh's vertices
+        uint32_t vertexLayout;
+        uint32_t padding;
+    };
+
+    struct MeshCacheEntry {
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint64_t textureOffset;
+        uint64_t subMeshOffset;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t textureCount;
+        uint32_t subMeshCount;
+        // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+        uint32_t indexType;
+        float boundsMin[3];
+        float boundsMax[3];
+        float boundsCenter[3];
+        float boundsRadius;
+        float positionScale[3];
+        float positionOffset[3];
+    };
+
+    struct MeshCacheSubMesh {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        float boundsMin[3];
+        float boundsMax[3];
+        float boundsCenter[3];
+        float boundsRadius;
+    };
+
+    // Binary copy of the final vertex/index buffers of a model, stored next to its .obj
+    class MeshCache
+    {
+    public:
+        // Bump whenever the layout or the mesh processing done by ReadOBJ changes
+        static const uint32_t VERSION = 4;
+
+        static std::string CachePath(std::string objFileName);
+
+        // Maps the cache of `objFileName`, fails if it is missing, corrupt, older than the .obj
+        // or built with other optimizer settings or another vertex layout
+        bool Open(std::string objFileName, uint64_t settingsKey, VertexLayout layout);
+        void Close();
+
+        size_t getMeshCount();
+        // Vertices and indices of a mesh, pointing into the mapped file
+        PackedGeometry getGeometry(size_t mesh);
+        // box and sphere
+        Bounds getBounds(size_t mesh);
+        // Texture references of a mesh, the ids are not loaded yet
+        std::vector<Texture> getTextures(size_t mesh);
+        std::vector<SubMesh> getSubMeshes(size_t mesh);
+
+        // Writes the meshes parsed from `objFileName` to its cache file, packed to `layout`
+        static bool Write(std::string objFileName, const std::vector<MeshData>& meshes, uint64_t settingsKey,
+            VertexLayout layout);
+
+    private:
+        MappedFile file;
+        const MeshCacheHeader* header = nullptr;
+        const MeshCacheEntry* entries = nullptr;
+
+        bool Validate();
+        static bool ReadSourceStamp(std::string objFileName, bool withHash, MeshCacheHeader& stamp);
+    };
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,473 @@
+#include "MeshOptimizer.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+    // Simulated LRU cache of the triangle ordering, and the valence above which all scores are equal
+    static const int FORSYTH_CACHE_SIZE = 32;
+    static const unsigned FORSYTH_MAX_VALENCE = 32;
+
+    static const unsigned NO_TRIANGLE = ~0u;
+
+    uint64_t MeshOptimizerSettings::getKey() const {
+        // the simulated cache and the overdraw samples only affect the report, not the stored meshes
+        uint32_t threshold;
+        memcpy(&threshold, &overdrawThreshold, sizeof(threshold));
+        uint32_t fields[] = { enabled ? 1u : 0u, optimizeOverdraw ? 1u : 0u, threshold, mergeByMaterial ? 1u : 0u };
+        return HashBytes(fields, sizeof(fields));
+    }
+
+    VertexCacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize) {
+        VertexCacheStats stats = { 0.0f, 0.0f };
+        if (indices.empty()) {
+            return stats;
+        }
+
+        // a vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+        std::vector<unsigned> loadedAt(vertexCount, 0);
+        std::vector<bool> referenced(vertexCount, false);
+        unsigned time = cacheSize + 1;
+        size_t misses = 0;
+        size_t referencedCount = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            GLuint vertex = indices[i];
+            if (time - loadedAt[vertex] > cacheSize) {
+                loadedAt[vertex] = time++;
+                misses++;
+            }
+            if (!referenced[vertex]) {
+                referenced[vertex] = true;
+                referencedCount++;
+            }
+        }
+
+        stats.acmr = (float)misses / (float)(indices.size() / 3);
+        stats.atvr = (float)misses / (float)referencedCount;
+        return stats;
+    }
+
+    // Forsyth's scoring: recently used vertices and vertices with few triangles left are preferred
+    static float ForsythCacheScore(int position) {
+        if (position < 0) {
+            return 0.0f;
+        }
+        if (position < 3) {
+            // the last triangle's vertices get a fixed score, so the strip does not just go back and forth
+            return 0.75f;
+        }
+        return powf(1.0f - (float)(position - 3) / (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+    }
+
+    static float ForsythValenceScore(unsigned remaining) {
+        return remaining == 0 ? 0.0f : 2.0f / sqrtf((float)remaining);
+    }
+
+    void OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        float cacheScores[FORSYTH_CACHE_SIZE + 1];
+        for (int i = 0; i <= FORSYTH_CACHE_SIZE; i++) {
+            cacheScores[i] = ForsythCacheScore(i - 1);
+        }
+        float valenceScores[FORSYTH_MAX_VALENCE + 1];
+        for (unsigned i = 0; i <= FORSYTH_MAX_VALENCE; i++) {
+            valenceScores[i] = ForsythValenceScore(i);
+        }
+
+        // triangles of each vertex, the first `remaining[v]` entries of its list are not emitted yet
+        std::vector<unsigned> remaining(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            remaining[indices[i]]++;
+        }
+        std::vector<unsigned> firstTriangle(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+        }
+        std::vector<unsigned> vertexTriangles(triangleCount * 3);
+        std::vector<unsigned> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            vertexTriangles[filled[indices[i]]++] = (unsigned)(i / 3);
+        }
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vertexScore[v] = valenceScores[std::min(remaining[v], FORSYTH_MAX_VALENCE)];
+        }
+
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<bool> emitted(triangleCount, false);
+        unsigned bestTriangle = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+            if (triangleScore[t] > triangleScore[bestTriangle]) {
+                bestTriangle = (unsigned)t;
+            }
+        }
+
+        std::vector<GLuint> optimized;
+        optimized.reserve(triangleCount * 3);
+        GLuint cache[FORSYTH_CACHE_SIZE + 3];
+        int cacheCount = 0;
+        size_t scanCursor = 0;
+
+        while (optimized.size() < triangleCount * 3) {
+            if (bestTriangle == NO_TRIANGLE) {
+                // nothing in the cache touches a triangle that is left, restart from the input order
+                while (emitted[scanCursor]) {
+                    scanCursor++;
+                }
+                bestTriangle = (unsigned)scanCursor;
+            }
+
+            const GLuint* corners = &indices[bestTriangle * 3];
+            for (int c = 0; c < 3; c++) {
+                GLuint vertex = corners[c];
+                optimized.push_back(vertex);
+
+                unsigned* triangles = &vertexTriangles[firstTriangle[vertex]];
+                for (unsigned i = 0; i < remaining[vertex]; i++) {
+                    if (triangles[i] == bestTriangle) {
+                        triangles[i] = triangles[--remaining[vertex]];
+                        break;
+                    }
+                }
+            }
+            emitted[bestTriangle] = true;
+
+            // move the triangle's vertices to the front of the LRU cache
+            GLuint newCache[FORSYTH_CACHE_SIZE + 3];
+            int newCount = 0;
+            for (int c = 0; c < 3; c++) {
+                if (std::find(newCache, newCache + newCount, corners[c]) == newCache + newCount) {
+                    newCache[newCount++] = corners[c];
+                }
+            }
+            for (int i = 0; i < cacheCount; i++) {
+                if (cache[i] != corners[0] && cache[i] != corners[1] && cache[i] != corners[2]) {
+                    newCache[newCount++] = cache[i];
+                }
+            }
+
+            for (int i = 0; i < newCount; i++) {
+                GLuint vertex = newCache[i];
+                cachePosition[vertex] = i < FORSYTH_CACHE_SIZE ? i : -1;
+                vertexScore[vertex] = cacheScores[cachePosition[vertex] + 1] +
+                    valenceScores[std::min(remaining[vertex], FORSYTH_MAX_VALENCE)];
+            }
+
+            // only triangles around the touched vertices changed score, the next one is picked among them
+            bestTriangle = NO_TRIANGLE;
+            float bestScore = -1.0f;
+            for (int i = 0; i < newCount; i++) {
+                GLuint vertex = newCache[i];
+                const unsigned* triangles = &vertexTriangles[firstTriangle[vertex]];
+                for (unsigned j = 0; j < remaining[vertex]; j++) {
+                    unsigned t = triangles[j];
+                    triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                    if (triangleScore[t] > bestScore) {
+                        bestScore = triangleScore[t];
+                        bestTriangle = t;
+                    }
+                }
+            }
+
+            cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+            std::copy(newCache, newCache + cacheCount, cache);
+        }
+
+        indices.swap(optimized);
+    }
+
+    // Misses of one triangle in a FIFO cache given as per-vertex load timestamps (see AnalyzeVertexCache)
+    static unsigned CacheMisses(const GLuint* corners, std::vector<unsigned>& loadedAt, unsigned& time, unsigned cacheSize) {
+        unsigned misses = 0;
+        for (int c = 0; c < 3; c++) {
+            if (time - loadedAt[corners[c]] > cacheSize) {
+                loadedAt[corners[c]] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+
+    void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold) {
+        const unsigned cacheSize = 16;
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // hard boundaries: the cache order restarts wherever a triangle misses on all three vertices
+        std::vector<size_t> hardBoundaries;
+        std::vector<unsigned> loadedAt(vertices.size(), 0);
+        unsigned time = cacheSize + 1;
+        for (size_t t = 0; t < triangleCount; t++) {
+            if (CacheMisses(&indices[t * 3], loadedAt, time, cacheSize) == 3 || t == 0) {
+                hardBoundaries.push_back(t);
+            }
+        }
+        hardBoundaries.push_back(triangleCount);
+
+        // soft boundaries: split a hard cluster again wherever its running ACMR is already within `threshold`
+        // of the ACMR of the whole cluster, so cutting there costs little cache efficiency
+        std::vector<size_t> clusters;
+        for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+            size_t begin = hardBoundaries[h];
+            size_t end = hardBoundaries[h + 1];
+
+            time += cacheSize + 1;
+            size_t clusterMisses = 0;
+            for (size_t t = begin; t < end; t++) {
+                clusterMisses += CacheMisses(&indices[t * 3], loadedAt, time, cacheSize);
+            }
+            float clusterThreshold = threshold * (float)clusterMisses / (float)(end - begin);
+
+            time += cacheSize + 1;
+            size_t runningMisses = 0;
+            size_t runningTriangles = 0;
+            clusters.push_back(begin);
+            for (size_t t = begin; t < end; t++) {
+                runningMisses += CacheMisses(&indices[t * 3], loadedAt, time, cacheSize);
+                runningTriangles++;
+                if ((float)runningMisses / (float)runningTriangles <= clusterThreshold && t + 1 < end) {
+                    clusters.push_back(t + 1);
+                    time += cacheSize + 1;
+                    runningMisses = 0;
+                    runningTriangles = 0;
+                }
+            }
+        }
+        clusters.push_back(triangleCount);
+
+        // sort key: how much a cluster faces away from the mesh centre, outward facing clusters occlude the rest
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        std::vector<glm::vec3> clusterCentroids(clusters.size() - 1, glm::vec3(0.0f));
+        std::vector<glm::vec3> clusterNormals(clusters.size() - 1, glm::vec3(0.0f));
+        for (size_t c = 0; c + 1 < clusters.size(); c++) {
+            float clusterArea = 0.0f;
+            for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+                const glm::vec3& a = vertices[indices[t * 3]].Position;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 normal = glm::cross(b - a, d - a);
+                float area = glm::length(normal);
+                glm::vec3 weightedCentroid = (a + b + d) * (area / 3.0f);
+
+                clusterCentroids[c] += weightedCentroid;
+                clusterNormals[c] += normal;
+                clusterArea += area;
+                meshCentroid += weightedCentroid;
+                meshArea += area;
+            }
+            if (clusterArea > 0.0f) {
+                clusterCentroids[c] /= clusterArea;
+            }
+        }
+        if (meshArea > 0.0f) {
+            meshCentroid /= meshArea;
+        }
+
+        std::vector<float> clusterKeys(clusters.size() - 1);
+        std::vector<size_t> clusterOrder(clusters.size() - 1);
+        for (size_t c = 0; c + 1 < clusters.size(); c++) {
+            float normalLength = glm::length(clusterNormals[c]);
+            clusterKeys[c] = normalLength > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]) / normalLength : 0.0f;
+            clusterOrder[c] = c;
+        }
+        std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&clusterKeys](size_t a, size_t b) {
+            return clusterKeys[a] > clusterKeys[b];
+        });
+
+        std::vector<GLuint> reordered;
+        reordered.reserve(indices.size());
+        for (size_t i = 0; i < clusterOrder.size(); i++) {
+            size_t c = clusterOrder[i];
+            reordered.insert(reordered.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+        }
+        indices.swap(reordered);
+    }
+
+    // Rasterizes the front facing triangles in submission order with a LESS depth test, counting the
+    // fragments that pass it when they are drawn (the ones early-z could not reject)
+    static void RasterizeOverdraw(const std::vector<glm::vec3>& projected, const std::vector<GLuint>& indices,
+        unsigned resolution, std::vector<float>& depth, size_t& shaded) {
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            const glm::vec3& a = projected[indices[t]];
+            const glm::vec3& b = projected[indices[t + 1]];
+            const glm::vec3& c = projected[indices[t + 2]];
+
+            float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+            if (area <= 0.0f) {
+                // back facing (GL_CCW front faces, GL_BACK culled) or degenerate
+                continue;
+            }
+
+            int minX = std::max(0, (int)floorf(std::min(a.x, std::min(b.x, c.x))));
+            int maxX = std::min((int)resolution - 1, (int)ceilf(std::max(a.x, std::max(b.x, c.x))));
+            int minY = std::max(0, (int)floorf(std::min(a.y, std::min(b.y, c.y))));
+            int maxY = std::min((int)resolution - 1, (int)ceilf(std::max(a.y, std::max(b.y, c.y))));
+
+            for (int y = minY; y <= maxY; y++) {
+                float py = (float)y + 0.5f;
+                for (int x = minX; x <= maxX; x++) {
+                    float px = (float)x + 0.5f;
+                    float w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+                    float w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+                    float w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                        continue;
+                    }
+
+                    float z = (w0 * a.z + w1 * b.z + w2 * c.z) / area;
+                    float& stored = depth[(size_t)y * resolution + x];
+                    if (z < stored) {
+                        stored = z;
+                        shaded++;
+                    }
+                }
+            }
+        }
+    }
+
+    OverdrawStats EstimateOverdraw(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        unsigned directionCount, unsigned resolution) {
+        OverdrawStats stats = { 0.0f, 0, 0 };
+        if (vertices.empty() || indices.empty() || directionCount == 0 || resolution == 0) {
+            return stats;
+        }
+
+        Bounds bounds = ComputeBounds(vertices);
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        float radius = std::max(glm::length(bounds.max - center), 1e-6f);
+
+        std::vector<glm::vec3> projected(vertices.size());
+        std::vector<float> depth((size_t)resolution * resolution);
+
+        for (unsigned i = 0; i < directionCount; i++) {
+            // Fibonacci sphere, the camera sits along `direction` and looks back at the mesh
+            float y = 1.0f - 2.0f * ((float)i + 0.5f) / (float)directionCount;
+            float ring = sqrtf(std::max(0.0f, 1.0f - y * y));
+            float angle = 2.39996323f * (float)i;
+            glm::vec3 direction(ring * cosf(angle), y, ring * sinf(angle));
+
+            glm::vec3 up = fabsf(direction.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+            glm::vec3 right = glm::normalize(glm::cross(up, direction));
+            up = glm::cross(direction, right);
+
+            float scale = 0.5f * (float)resolution / radius;
+            for (size_t v = 0; v < vertices.size(); v++) {
+                glm::vec3 offset = vertices[v].Position - center;
+                projected[v] = glm::vec3((glm::dot(offset, right) * scale) + 0.5f * (float)resolution,
+                    (glm::dot(offset, up) * scale) + 0.5f * (float)resolution,
+                    radius - glm::dot(offset, direction));
+            }
+
+            std::fill(depth.begin(), depth.end(), INFINITY);
+            RasterizeOverdraw(projected, indices, resolution, depth, stats.pixelsShaded);
+            for (size_t p = 0; p < depth.size(); p++) {
+                stats.pixelsCovered += depth[p] != INFINITY;
+            }
+        }
+
+        stats.overdraw = stats.pixelsCovered > 0 ? (float)stats.pixelsShaded / (float)stats.pixelsCovered : 0.0f;
+        return stats;
+    }
+
+    void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+        const GLuint unused = ~0u;
+        std::vector<GLuint> remap(vertices.size(), unused);
+        std::vector<Vertex> reordered;
+        reordered.reserve(vertices.size());
+
+        for (size_t i = 0; i < indices.size(); i++) {
+            GLuint& newIndex = remap[indices[i]];
+            if (newIndex == unused) {
+                newIndex = (GLuint)reordered.size();
+                reordered.push_back(vertices[indices[i]]);
+            }
+            indices[i] = newIndex;
+        }
+
+        vertices.swap(reordered);
+    }
+
+    void MergeMeshesByMaterial(std::vector<MeshData>& meshes) {
+        std::vector<MeshData> merged;
+        std::unordered_map<std::string, size_t> mergedByTextures;
+
+        for (size_t i = 0; i < meshes.size(); i++) {
+            MeshData& mesh = meshes[i];
+            std::string key;
+            for (size_t t = 0; t < mesh.textures.size(); t++) {
+                key += mesh.textures[t].type + '\n' + mesh.textures[t].path + '\n';
+            }
+
+            std::unordered_map<std::string, size_t>::iterator found = mergedByTextures.find(key);
+            if (found == mergedByTextures.end()) {
+                found = mergedByTextures.emplace(key, merged.size()).first;
+                MeshData target;
+                target.textures = mesh.textures;
+                target.bounds = mesh.bounds;
+                merged.push_back(target);
+            }
+            MeshData& target = merged[found->second];
+
+            SubMesh subMesh;
+            subMesh.firstIndex = (GLuint)target.indices.size();
+            subMesh.indexCount = (GLsizei)mesh.indices.size();
+            subMesh.bounds = mesh.bounds;
+            target.subMeshes.push_back(subMesh);
+
+            GLuint baseVertex = (GLuint)target.vertices.size();
+            target.vertices.insert(target.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            for (size_t j = 0; j < mesh.indices.size(); j++) {
+                target.indices.push_back(mesh.indices[j] + baseVertex);
+            }
+            target.bounds.min = glm::min(target.bounds.min, mesh.bounds.min);
+            target.bounds.max = glm::max(target.bounds.max, mesh.bounds.max);
+        }
+
+        meshes.swap(merged);
+    }
+
+    void OptimizeMesh(MeshData& mesh, const MeshOptimizerSettings& settings, std::ostream& log) {
+        if (!settings.enabled) {
+            return;
+        }
+
+        VertexCacheStats before = AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), settings.simulatedCacheSize);
+        bool reportOverdraw = settings.reportOverdraw && settings.overdrawSampleDirections > 0;
+        OverdrawStats overdrawBefore = { 0.0f, 0, 0 };
+        if (reportOverdraw) {
+            overdrawBefore = EstimateOverdraw(mesh.vertices, mesh.indices,
+                settings.overdrawSampleDirections, settings.overdrawSampleResolution);
+        }
+
+        OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+        if (settings.optimizeOverdraw) {
+            OptimizeOverdraw(mesh.indices, mesh.vertices, settings.overdrawThreshold);
+        }
+        // last, the fetch order follows the final triangle order
+        OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+        VertexCacheStats after = AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), settings.simulatedCacheSize);
+        log << "ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr;
+        if (reportOverdraw) {
+            OverdrawStats overdrawAfter = EstimateOverdraw(mesh.vertices, mesh.indices,
+                settings.overdrawSampleDirections, settings.overdrawSampleResolution);
+            log << ", overdraw " << overdrawBefore.overdraw << " -> " << overdrawAfter.overdraw;
+        }
+        log << std::endl;
+    }
+}
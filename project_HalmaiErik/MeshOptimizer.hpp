@@ -0,0 +1,76 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace gps {
+
+    // Which optimization passes run on freshly parsed meshes (cached meshes keep what they were built with)
+    struct MeshOptimizerSettings {
+        bool enabled = true;
+        // clusters the cache-ordered triangles and draws the outward facing clusters first
+        bool optimizeOverdraw = true;
+        // ACMR a cluster may lose to overdraw ordering: 1 keeps the cache order almost intact,
+        // larger values cut the mesh into more, smaller clusters that sort better front to back
+        float overdrawThreshold = 1.05f;
+        // combines the meshes that share a texture set into one mesh with a sub-range per shape
+        bool mergeByMaterial = true;
+
+        // cache size assumed when reporting ACMR/ATVR
+        unsigned simulatedCacheSize = 16;
+        // rasterizes every mesh from the sample views before and after optimizing to report the overdraw in the
+        // load log; an offline metric, too slow for the load path, so off unless tuning the optimizer
+        bool reportOverdraw = false;
+        // views used to estimate the overdraw, 0 skips the estimate
+        unsigned overdrawSampleDirections = 8;
+        unsigned overdrawSampleResolution = 128;
+
+        // Identifies the settings in the mesh cache, a cache built with other settings is rebuilt
+        uint64_t getKey() const;
+    };
+
+    // Post-transform cache efficiency of an index buffer, simulated with a FIFO cache
+    struct VertexCacheStats {
+        // average cache misses per triangle, 0.5 is the best a regular grid can do and 3 the worst
+        float acmr;
+        // average transforms per referenced vertex, 1 is ideal
+        float atvr;
+    };
+
+    // Shaded fragments per covered pixel, with early-z, back-face culling and the triangles drawn in order
+    struct OverdrawStats {
+        float overdraw;
+        size_t pixelsCovered;
+        size_t pixelsShaded;
+    };
+
+    VertexCacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize);
+
+    // Reorders the triangles for post-transform cache locality (Forsyth's linear-speed algorithm)
+    void OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount);
+
+    // Reorders clusters of an already cache-optimized index buffer so likely occluders are drawn first
+    // (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+    void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold);
+
+    // Offline overdraw metric: rasterizes the mesh orthographically from `directionCount` directions spread
+    // over the sphere into a `resolution` square depth buffer and averages the result
+    OverdrawStats EstimateOverdraw(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        unsigned directionCount, unsigned resolution);
+
+    // Renumbers the vertices in the order the index buffer first uses them and drops unreferenced ones
+    void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    // Concatenates the meshes with identical textures (type and path), in order of first use;
+    // each source mesh becomes a SubMesh of the result
+    void MergeMeshesByMaterial(std::vector<MeshData>& meshes);
+
+    // Runs the enabled passes on a mesh and logs its ACMR/ATVR (and estimated overdraw) before and after
+    void OptimizeMesh(MeshData& mesh, const MeshOptimizerSettings& settings, std::ostream& log);
+}
+
+#endif /* MeshOptimizer_hpp */
@@ -0,0 +1,261 @@
+#include "MipChain.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    // Resolution of the linear -> sRGB table, fine enough that every 8-bit sRGB value stays reachable
+    static const int LINEAR_TO_SRGB_STEPS = 16384;
+
+    struct ConversionTables {
+        // 8-bit value -> [0, 1], through the sRGB curve or as plain unorm
+        float srgbToLinear[256];
+        float unormToFloat[256];
+        unsigned char linearToSrgb[LINEAR_TO_SRGB_STEPS];
+    };
+
+    static const ConversionTables& GetConversionTables() {
+        static const ConversionTables* tables = []() {
+            ConversionTables* built = new ConversionTables();
+            for (int i = 0; i < 256; i++) {
+                float value = i / 255.0f;
+                built->unormToFloat[i] = value;
+                built->srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i < LINEAR_TO_SRGB_STEPS; i++) {
+                float linear = (float)i / (LINEAR_TO_SRGB_STEPS - 1);
+                float value = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+                built->linearToSrgb[i] = (unsigned char)std::min(255L, lroundf(value * 255.0f));
+            }
+            return built;
+        }();
+        return *tables;
+    }
+
+    size_t MipChain::getSize() const {
+        size_t size = 0;
+        for (size_t i = 0; i < levels.size(); i++) {
+            size += levels[i].size();
+        }
+        return size;
+    }
+
+    // alpha is the last channel of 2 and 4 channel images
+    static bool IsAlphaChannel(int channel, int channels) {
+        return (channels == 4 && channel == 3) || (channels == 2 && channel == 1);
+    }
+
+    // Source texels of one output texel along an axis and their weights, zero for the unused ones
+    struct FilterTaps {
+        int source[3];
+        float weights[3];
+    };
+
+    // Box filter from `size` texels down to max(1, size / 2): even sizes average pairs, on odd sizes each output
+    // covers size / half input texels, so the texel between two outputs is split between them
+    static void ComputeTaps(int size, std::vector<FilterTaps>& taps) {
+        int half = std::max(1, size / 2);
+        taps.resize(half);
+        for (int i = 0; i < half; i++) {
+            FilterTaps& tap = taps[i];
+            for (int t = 0; t < 3; t++) {
+                tap.source[t] = std::min(i * 2 + t, size - 1);
+            }
+            if (size == 1) {
+                tap.weights[0] = 1.0f;
+                tap.weights[1] = 0.0f;
+                tap.weights[2] = 0.0f;
+            }
+            else if (size % 2 == 0) {
+                tap.weights[0] = 0.5f;
+                tap.weights[1] = 0.5f;
+                tap.weights[2] = 0.0f;
+            }
+            else {
+                tap.weights[0] = (float)(half - i) / size;
+                tap.weights[1] = (float)half / size;
+                tap.weights[2] = (float)(i + 1) / size;
+            }
+        }
+    }
+
+    // row[i] = a[i] * wa + b[i] * wb (+ c[i] * wc when `c` is set), four values of any texels per SSE2 step
+    static void BlendRows(const float* a, float wa, const float* b, float wb, const float* c, float wc, size_t count,
+        float* row) {
+        size_t i = 0;
+#ifdef GPS_SSE2
+        const __m128 weightA = _mm_set1_ps(wa);
+        const __m128 weightB = _mm_set1_ps(wb);
+        const __m128 weightC = _mm_set1_ps(wc);
+        for (; i + 4 <= count; i += 4) {
+            __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), weightA), _mm_mul_ps(_mm_loadu_ps(b + i), weightB));
+            if (c) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(c + i), weightC));
+            }
+            _mm_storeu_ps(row + i, sum);
+        }
+#endif
+        for (; i < count; i++) {
+            row[i] = a[i] * wa + b[i] * wb + (c ? c[i] * wc : 0.0f);
+        }
+    }
+
+    void DownsampleLevel(const unsigned char* source, int width, int height, int channels, bool srgb,
+        std::vector<unsigned char>& half) {
+        const ConversionTables& tables = GetConversionTables();
+        int halfWidth = std::max(1, width / 2);
+        int halfHeight = std::max(1, height / 2);
+        half.resize((size_t)halfWidth * halfHeight * channels);
+
+        const size_t rowSize = (size_t)width * channels;
+        const size_t halfRowSize = (size_t)halfWidth * channels;
+
+        // per value of a source row: its decode table; per value of an output row: its scale and encode
+        std::vector<const float*> toFloat(rowSize);
+        for (size_t i = 0; i < rowSize; i++) {
+            bool linearize = srgb && !IsAlphaChannel((int)(i % channels), channels);
+            toFloat[i] = linearize ? tables.srgbToLinear : tables.unormToFloat;
+        }
+        std::vector<float> scale(halfRowSize);
+        std::vector<bool> throughTable(halfRowSize);
+        for (size_t i = 0; i < halfRowSize; i++) {
+            throughTable[i] = srgb && !IsAlphaChannel((int)(i % channels), channels);
+            scale[i] = throughTable[i] ? (float)(LINEAR_TO_SRGB_STEPS - 1) : 255.0f;
+        }
+
+        std::vector<FilterTaps> columnTaps, rowTaps;
+        ComputeTaps(width, columnTaps);
+        ComputeTaps(height, rowTaps);
+
+        // linear source rows, the last row of one output row is the first of the next on odd heights
+        std::vector<float> linear[3];
+        int converted[3] = { -1, -1, -1 };
+        for (int t = 0; t < 3; t++) {
+            linear[t].resize(rowSize);
+        }
+        std::vector<float> column(rowSize);
+        std::vector<float> filtered(halfRowSize);
+        std::vector<int32_t> quantized(halfRowSize);
+
+        for (int y = 0; y < halfHeight; y++) {
+            const FilterTaps& rowTap = rowTaps[y];
+            if (converted[2] == rowTap.source[0]) {
+                std::swap(linear[0], linear[2]);
+                std::swap(converted[0], converted[2]);
+            }
+            for (int t = 0; t < 3; t++) {
+                if (rowTap.weights[t] == 0.0f || converted[t] == rowTap.source[t]) {
+                    continue;
+                }
+                // the 8-bit decode is a table lookup, it stays scalar
+                const unsigned char* row = source + (size_t)rowTap.source[t] * rowSize;
+                for (size_t i = 0; i < rowSize; i++) {
+                    linear[t][i] = toFloat[i][row[i]];
+                }
+                converted[t] = rowTap.source[t];
+            }
+
+            // vertical pass over whole rows, then the horizontal one
+            BlendRows(linear[0].data(), rowTap.weights[0], rowTap.weights[1] != 0.0f ? linear[1].data() : linear[0].data(),
+                rowTap.weights[1], rowTap.weights[2] != 0.0f ? linear[2].data() : nullptr, rowTap.weights[2], rowSize,
+                column.data());
+
+            for (int x = 0; x < halfWidth; x++) {
+                const FilterTaps& columnTap = columnTaps[x];
+                float* out = &filtered[(size_t)x * channels];
+#ifdef GPS_SSE2
+                if (channels == 4) {
+                    __m128 sum = _mm_setzero_ps();
+                    for (int t = 0; t < 3; t++) {
+                        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&column[(size_t)columnTap.source[t] * 4]),
+                            _mm_set1_ps(columnTap.weights[t])));
+                    }
+                    _mm_storeu_ps(out, sum);
+                    continue;
+                }
+#endif
+                for (int c = 0; c < channels; c++) {
+                    float sum = 0.0f;
+                    for (int t = 0; t < 3; t++) {
+                        sum += column[(size_t)columnTap.source[t] * channels + c] * columnTap.weights[t];
+                    }
+                    out[c] = sum;
+                }
+            }
+
+            size_t i = 0;
+#ifdef GPS_SSE2
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            for (; i + 4 <= halfRowSize; i += 4) {
+                __m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&filtered[i]), zero), one);
+                _mm_storeu_si128((__m128i*)&quantized[i], _mm_cvtps_epi32(_mm_mul_ps(value, _mm_loadu_ps(&scale[i]))));
+            }
+#endif
+            for (; i < halfRowSize; i++) {
+                quantized[i] = (int32_t)lroundf(std::min(1.0f, std::max(0.0f, filtered[i])) * scale[i]);
+            }
+
+            unsigned char* out = &half[(size_t)y * halfRowSize];
+            for (i = 0; i < halfRowSize; i++) {
+                out[i] = throughTable[i] ? tables.linearToSrgb[quantized[i]] : (unsigned char)quantized[i];
+            }
+        }
+    }
+
+    void GenerateMipChain(const Image& image, bool srgb, bool mipmaps, MipChain& chain) {
+        chain.width = image.width;
+        chain.height = image.height;
+        chain.channels = image.channels;
+        chain.levels.clear();
+        chain.levels.push_back(std::vector<unsigned char>(image.pixels.get(), image.pixels.get() + image.getSize()));
+
+        int width = image.width;
+        int height = image.height;
+        while (mipmaps && (width > 1 || height > 1)) {
+            std::vector<unsigned char> half;
+            DownsampleLevel(chain.levels.back().data(), width, height, image.channels, srgb, half);
+            chain.levels.push_back(std::move(half));
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+    }
+
+    void UploadMipChain(const MipChain& chain, bool srgb) {
+        GLenum format = chain.channels == 4 ? GL_RGBA : GL_RGB;
+        GLenum internalFormat = chain.channels == 4 ? (srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8) : (srgb ? GL_SRGB8 : GL_RGB8);
+        GLsizei levelCount = (GLsizei)chain.levels.size();
+
+        // RGB rows of the small levels are not 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        bool immutable = GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+        if (immutable) {
+            glTexStorage2D(GL_TEXTURE_2D, levelCount, internalFormat, chain.width, chain.height);
+        }
+
+        int width = chain.width;
+        int height = chain.height;
+        for (GLsizei level = 0; level < levelCount; level++) {
+            if (immutable) {
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, GL_UNSIGNED_BYTE, chain.levels[level].data());
+            }
+            else {
+                glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE,
+                    chain.levels[level].data());
+            }
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        if (!immutable) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+}
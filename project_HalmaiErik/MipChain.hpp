@@ -0,0 +1,37 @@
+#ifndef MipChain_hpp
+#define MipChain_hpp
+
+#include <GL/glew.h>
+
+#include "Image.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Uncompressed 8-bit mip levels of one image, level 0 first
+    struct MipChain {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<std::vector<unsigned char>> levels;
+
+        size_t getSize() const;
+    };
+
+    // Box filters `source` into `half` (max(1, width / 2) by max(1, height / 2)), separably: even axes average
+    // texel pairs, odd axes weight three texels per output so every source texel counts equally and the last row
+    // and column are not dropped. With `srgb` the color channels are filtered in linear space, alpha always is.
+    // The filtering runs with SSE2 over whole rows where available; the 8-bit decode and sRGB encode are table lookups.
+    void DownsampleLevel(const unsigned char* source, int width, int height, int channels, bool srgb,
+        std::vector<unsigned char>& half);
+
+    // Copies `image` into level 0 and, with `mipmaps`, downsamples down to 1x1
+    void GenerateMipChain(const Image& image, bool srgb, bool mipmaps, MipChain& chain);
+
+    // Uploads every level to the bound GL_TEXTURE_2D: immutable storage with glTexStorage2D + glTexSubImage2D
+    // when the GPU has it, one glTexImage2D per level otherwise
+    void UploadMipChain(const MipChain& chain, bool srgb);
+}
+
+#endif /* MipChain_hpp */
@@ -1,47 +1,168 @@
 #include "Model3D.hpp"
+#include "InstanceBuffer.hpp"
 
 namespace gps {
 
+	// Hashes the raw bytes of a vertex, so only bit-identical corners are welded
+	size_t VertexHash::operator()(const gps::Vertex& vertex) const {
+		return (size_t)HashBytes(&vertex, sizeof(gps::Vertex));
+	}
+
+	bool VertexEqual::operator()(const gps::Vertex& a, const gps::Vertex& b) const {
+		return memcmp(&a, &b, sizeof(gps::Vertex)) == 0;
+	}
+
+	MeshOptimizerSettings Model3D::optimizerSettings;
+
+	// Collects every distinct texture path referenced by the parsed meshes
+	std::vector<std::string> ModelData::getTexturePaths() {
+		std::vector<std::string> paths;
+		size_t meshCount = cache ? cache->getMeshCount() : meshes.size();
+		for (size_t i = 0; i < meshCount; i++) {
+			std::vector<gps::Texture> textures = cache ? cache->getTextures(i) : meshes[i].textures;
+			for (size_t t = 0; t < textures.size(); t++) {
+				if (std::find(paths.begin(), paths.end(), textures[t].path) == paths.end()) {
+					paths.push_back(textures[t].path);
+				}
+			}
+		}
+		return paths;
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
-		ReadOBJ(fileName, basePath);
+		ModelData data;
+		if (!ParseModel(fileName, basePath, data)) {
+			exit(1);
+		}
+
+		UploadModel(data, nullptr);
+	}
+
+	// Maps the mesh cache if it is fresh, otherwise parses the .obj and refreshes the cache
+	bool Model3D::ParseModel(std::string fileName, std::string basePath, ModelData& data)
+	{
+		data.fileName = fileName;
+
+		std::shared_ptr<MeshCache> cache = std::make_shared<MeshCache>();
+		if (cache->Open(fileName, optimizerSettings.getKey(), Mesh::vertexLayout)) {
+			std::cout << "Loading : " << fileName << " (mesh cache)" << std::endl;
+			data.cache = cache;
+			return true;
+		}
+
+		// buffer the log so models parsed on different threads do not interleave
+		std::ostringstream log;
+		bool ret = ReadOBJ(fileName, basePath, data.meshes, log);
+
+		if (ret) {
+			for (size_t i = 0; i < data.meshes.size() && optimizerSettings.enabled; i++) {
+				log << "  mesh " << i << " : ";
+				OptimizeMesh(data.meshes[i], optimizerSettings, log);
+			}
+			// merged after optimizing, so every shape stays one contiguous range of the index buffer
+			if (optimizerSettings.mergeByMaterial) {
+				size_t shapeCount = data.meshes.size();
+				MergeMeshesByMaterial(data.meshes);
+				log << "  merged " << shapeCount << " shapes into " << data.meshes.size() << " meshes by material" << std::endl;
+			}
+			MeshCache::Write(fileName, data.meshes, optimizerSettings.getKey(), Mesh::vertexLayout);
+		}
+		std::cout << log.str() << std::flush;
+
+		return ret;
+	}
+
+	// Creates the GL textures and buffers, the mapped cache data goes straight to glBufferData
+	void Model3D::UploadModel(ModelData& data, const PendingImages* images)
+	{
+		// start decoding every texture of the model at once, the uploads below consume them in order
+		PendingImages prefetched;
+		if (!images) {
+			std::vector<std::string> texturePaths = data.getTexturePaths();
+			for (size_t i = 0; i < texturePaths.size(); i++) {
+				std::shared_future<Image> image = DecodeTextureAsync(texturePaths[i]);
+				if (image.valid()) {
+					prefetched[texturePaths[i]] = image;
+				}
+			}
+			images = &prefetched;
+		}
+
+		size_t meshCount = data.cache ? data.cache->getMeshCount() : data.meshes.size();
+		for (size_t i = 0; i < meshCount; i++) {
+			std::vector<gps::Texture> textures = data.cache ? data.cache->getTextures(i) : data.meshes[i].textures;
+			for (size_t t = 0; t < textures.size(); t++) {
+				textures[t] = LoadTexture(textures[t].path, textures[t].type, images);
+			}
+
+			if (data.cache) {
+				meshes.push_back(gps::Mesh(data.cache->getGeometry(i), data.cache->getBounds(i), textures,
+					data.cache->getSubMeshes(i)));
+			}
+			else {
+				meshes.push_back(gps::Mesh(std::move(data.meshes[i].vertices), std::move(data.meshes[i].indices), textures,
+					data.meshes[i].subMeshes));
+			}
+		}
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	void Model3D::Draw(const gps::Shader& shaderProgram)
 	{
 		for (int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shaderProgram);
 	}
 
+	void Model3D::DrawInstanced(const gps::Shader& shaderProgram, const glm::mat4* models, GLsizei count)
+	{
+		if (count <= 0)
+			return;
+		// the instances carry the mesh's position decode, so they are streamed again for every mesh
+		for (size_t i = 0; i < meshes.size(); i++) {
+			InstanceBuffer::getInstance().Upload(models, count, meshes[i].getPositionScale(), meshes[i].getPositionOffset());
+			meshes[i].DrawInstanced(shaderProgram, count);
+		}
+	}
+
+	void Model3D::DrawInstanced(const gps::Shader& shaderProgram, const std::vector<glm::mat4>& models)
+	{
+		DrawInstanced(shaderProgram, models.data(), (GLsizei)models.size());
+	}
+
+	std::vector<gps::Mesh>& Model3D::getMeshes()
+	{
+		return meshes;
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	bool Model3D::ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& meshes, std::ostream& log){
 
-        std::cout << "Loading : " << fileName << std::endl;
+        log << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret = gps::ObjReader::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true);
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
 		}
 
 		if (!ret) {
-			exit(1);
+			return false;
 		}
 
-		std::cout << "# of shapes    : " << shapes.size() << std::endl;
-		std::cout << "# of materials : " << materials.size() << std::endl;
+		log << "# of shapes    : " << shapes.size() << std::endl;
+		log << "# of materials : " << materials.size() << std::endl;
 
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
@@ -49,6 +170,10 @@ namespace gps {
 			std::vector<GLuint> indices;
 			std::vector<gps::Texture> textures;
 
+			// Maps each distinct (position, normal, texcoord) tuple to its slot in `vertices`
+			std::unordered_map<gps::Vertex, GLuint, VertexHash, VertexEqual> weldedVertices;
+			weldedVertices.reserve(shapes[s].mesh.indices.size());
+
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
@@ -65,9 +190,14 @@ namespace gps {
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
-					float nx = attrib.normals[3 * idx.normal_index + 0];
-					float ny = attrib.normals[3 * idx.normal_index + 1];
-					float nz = attrib.normals[3 * idx.normal_index + 2];
+					float nx = 0.0f;
+					float ny = 0.0f;
+					float nz = 0.0f;
+					if (idx.normal_index != -1) {
+						nx = attrib.normals[3 * idx.normal_index + 0];
+						ny = attrib.normals[3 * idx.normal_index + 1];
+						nz = attrib.normals[3 * idx.normal_index + 2];
+					}
 					float tx = 0.0f;
 					float ty = 0.0f;
 					if (idx.texcoord_index != -1) {
@@ -84,14 +214,24 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
-					vertices.push_back(currentVertex);
-
-					indices.push_back(index_offset + v);
+					// weld identical corners into one shared vertex
+					auto welded = weldedVertices.find(currentVertex);
+					if (welded == weldedVertices.end()) {
+						GLuint newIndex = (GLuint)vertices.size();
+						weldedVertices.emplace(currentVertex, newIndex);
+						vertices.push_back(currentVertex);
+						indices.push_back(newIndex);
+					}
+					else {
+						indices.push_back(welded->second);
+					}
 				}
 
 				index_offset += fv;
 			}
 
+			log << "  shape " << s << " : " << indices.size() << " -> " << vertices.size() << " vertices after welding" << std::endl;
+
 			// get material id
 			// Only try to read materials if the .mtl file is present
 			int a = shapes[s].mesh.material_ids.size();
@@ -108,7 +248,9 @@ namespace gps {
 					if (!ambientTexturePath.empty())
 					{
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "ambientTexture";
+						currentTexture.path = basePath + ambientTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -117,7 +259,9 @@ namespace gps {
 					if (!diffuseTexturePath.empty())
 					{
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "diffuseTexture";
+						currentTexture.path = basePath + diffuseTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -126,46 +270,73 @@ namespace gps {
 					if (!specularTexturePath.empty())
 					{
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "specularTexture";
+						currentTexture.path = basePath + specularTexturePath;
 						textures.push_back(currentTexture);
 					}
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			gps::MeshData mesh;
+			mesh.bounds = ComputeBounds(vertices);
+			mesh.vertices = std::move(vertices);
+			mesh.indices = std::move(indices);
+			mesh.textures = textures;
+			meshes.push_back(std::move(mesh));
 		}
+
+		return true;
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
-
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
-				}
-			}
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type, const PendingImages* images) {
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			auto decoded = images ? images->find(path) : PendingImages::const_iterator();
+			if (images && decoded != images->end() && decoded->second.valid()) {
+				std::shared_future<Image> image = decoded->second;
+				currentTexture.id = TextureCache::getInstance().Acquire(path,
+					[image]() { return image.get(); },
+					[this, path](const Image& pixels) { return UploadTexture(pixels, path.c_str()); });
+			}
+			else {
+				currentTexture.id = ReadTextureFromFile(path.c_str());
+			}
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
+			// one cache reference per texture slot, released by the destructor
 			loadedTextures.push_back(currentTexture);
 
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
+	// Reads the pixel data from an image file and loads it into the video memory, unless it is cached
 	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
-		}
+		std::string path = file_name;
+		return TextureCache::getInstance().Acquire(path,
+			[path]() {
+				std::shared_future<Image> image = DecodeTextureAsync(path);
+				return image.valid() ? image.get() : Image();
+			},
+			[this, path](const Image& pixels) { return UploadTexture(pixels, path.c_str()); });
+	}
+
+	// Decodes a model texture as flipped RGBA with its mip chain (block compressed when the GPU supports it),
+	// the layout UploadTexture expects; the future is invalid if the texture cache already holds it
+	std::shared_future<Image> Model3D::DecodeTextureAsync(std::string path, std::function<void()> onDecoded) {
+		return TextureCache::getInstance().DecodeAsync(path, [path](std::function<void()> onDone) {
+			int force_channels = 4;
+			return TextureDecoder::getInstance().Decode(path, force_channels, true, onDone,
+				TextureCompressor::getEffectiveCompression(), true);
+		}, onDecoded);
+	}
+
+	// Loads already decoded (and flipped) RGBA pixel data, or its prebuilt (possibly compressed) mip chain, into the video memory
+	GLuint Model3D::UploadTexture(const Image& image, const char* file_name) {
+		int x = image.width;
+		int y = image.height;
 		// NPOT check
 		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
 			fprintf(
@@ -173,39 +344,29 @@ namespace gps {
 			);
 		}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
-
 		GLuint textureID;
 		glGenTextures(1, &textureID);
 		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		if (image.compressed) {
+			TextureCompressor::Upload(GL_TEXTURE_2D, *image.compressed, true, file_name);
+		}
+		else if (image.mips) {
+			UploadMipChain(*image.mips, true);
+		}
+		else {
+			glTexImage2D(
+				GL_TEXTURE_2D,
+				0,
+				GL_SRGB, //GL_SRGB,//GL_RGBA,
+				x,
+				y,
+				0,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				image.pixels.get()
+			);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -218,10 +379,14 @@ namespace gps {
 
 	Model3D::~Model3D() {
         for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            TextureCache::getInstance().Release(loadedTextures.at(i).id);
         }
 
         for (size_t i = 0; i < meshes.size(); i++) {
+            // arena meshes share the GeometryArena's buffers
+            if (meshes.at(i).isInArena()) {
+                continue;
+            }
             GLuint VBO = meshes.at(i).getBuffers().VBO;
             GLuint EBO = meshes.at(i).getBuffers().EBO;
             GLuint VAO = meshes.at(i).getBuffers().VAO;
@@ -2,27 +2,78 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "ObjReader.hpp"
+#include "Image.hpp"
+#include "TextureCache.hpp"
+#include "TextureDecoder.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
 
+    // Hash and equality used to weld identical vertices while reading an .obj
+    struct VertexHash {
+        size_t operator()(const gps::Vertex& vertex) const;
+    };
+
+    struct VertexEqual {
+        bool operator()(const gps::Vertex& a, const gps::Vertex& b) const;
+    };
+
+    // Everything LoadModel needs before touching GL: either parsed meshes or a mapped mesh cache
+    struct ModelData {
+        std::string fileName;
+        std::vector<gps::MeshData> meshes;
+        std::shared_ptr<gps::MeshCache> cache;
+
+        std::vector<std::string> getTexturePaths();
+    };
+
     class Model3D
     {
 
     public:
         ~Model3D();
 
+		// Processing applied to meshes parsed from an .obj, before they are cached
+		static MeshOptimizerSettings optimizerSettings;
+
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		// CPU half of LoadModel (cache lookup, .obj/.mtl parsing), safe to run on a worker thread
+		static bool ParseModel(std::string fileName, std::string basePath, ModelData& data);
+
+		// GL half of LoadModel, textures found in `images` are uploaded without decoding them again;
+		// the others are decoded in parallel on the TextureDecoder pool
+		void UploadModel(ModelData& data, const PendingImages* images);
+
+		// Queues the decode of a texture in the layout UploadTexture expects
+		static std::shared_future<Image> DecodeTextureAsync(std::string path, std::function<void()> onDecoded = nullptr);
+
+		void Draw(const gps::Shader& shaderProgram);
+
+		// Draws the model once per transform with one instanced draw call per mesh; the instanced shaders
+		// (basicInstanced.vert, depthMapShaderInstanced.vert) read the transforms instead of the model uniform
+		void DrawInstanced(const gps::Shader& shaderProgram, const glm::mat4* models, GLsizei count);
+		void DrawInstanced(const gps::Shader& shaderProgram, const std::vector<glm::mat4>& models);
+
+		// Component meshes, for code that issues the draws itself (RenderQueue)
+		std::vector<gps::Mesh>& getMeshes();
 
     private:
 		// Component meshes - group of objects
@@ -31,13 +82,16 @@ namespace gps {
         std::vector<gps::Texture> loadedTextures;
 
 		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		static bool ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& meshes, std::ostream& log);
 
 		// Retrieves a texture associated with the object - by its name and type
-		gps::Texture LoadTexture(std::string path, std::string type);
+		gps::Texture LoadTexture(std::string path, std::string type, const PendingImages* images);
 
 		// Reads the pixel data from an image file and loads it into the video memory
 		GLuint ReadTextureFromFile(const char* file_name);
+
+		// Loads decoded pixel data into the video memory
+		GLuint UploadTexture(const Image& image, const char* file_name);
     };
 }
 
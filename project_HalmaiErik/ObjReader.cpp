@@ -0,0 +1,578 @@
+#include "ObjReader.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+
+namespace gps {
+
+    // Statements that change the shape/material state; they are replayed in file order while merging
+    enum ObjCommandType { OBJ_FACES, OBJ_USEMTL, OBJ_MTLLIB, OBJ_GROUP, OBJ_OBJECT };
+
+    struct ObjCommand {
+        ObjCommandType type;
+        std::string name;
+        // OBJ_FACES only: a run of consecutive face statements of the chunk
+        size_t statementCount;
+        size_t firstFace;
+        size_t faceCount;
+        size_t firstCorner;
+        size_t cornerCount;
+    };
+
+    // Everything parsed from one line-aligned slice of the file
+    struct ObjChunk {
+        const char* begin;
+        const char* end;
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        std::vector<tinyobj::index_t> corners;
+        std::vector<unsigned char> faceSizes;
+        std::vector<ObjCommand> commands;
+        // corner * 3 + component of negative (relative) indices, which still lack the counts of the previous chunks
+        std::vector<size_t> relativeIndices;
+    };
+
+    static const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    static inline bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline bool IsSpace(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    static inline const char* SkipSpaces(const char* p, const char* end) {
+        while (p < end && IsSpace(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // End of the current whitespace separated field
+    static inline const char* FieldEnd(const char* p, const char* end) {
+        while (p < end && !IsSpace(*p) && *p != '\r') {
+            p++;
+        }
+        return p;
+    }
+
+    // Decimal float parser: mantissa in a uint64 and an exact power of ten, strtod only for huge exponents
+    static float ParseFloat(const char* p, const char* end) {
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool anyDigit = false;
+        for (; p < end && IsDigit(*p); p++) {
+            anyDigit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += mantissa != 0;
+            }
+            else {
+                exponent++;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && IsDigit(*p); p++) {
+                anyDigit = true;
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+            }
+        }
+        if (!anyDigit) {
+            return 0.0f;
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '+' || *p == '-')) {
+                negativeExponent = *p == '-';
+                p++;
+            }
+            int explicitExponent = 0;
+            for (; p < end && IsDigit(*p); p++) {
+                if (explicitExponent < 10000) {
+                    explicitExponent = explicitExponent * 10 + (*p - '0');
+                }
+            }
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+        }
+
+        double value = (double)mantissa;
+        if (exponent < 0 && exponent >= -22) {
+            value /= POWERS_OF_TEN[-exponent];
+        }
+        else if (exponent > 0 && exponent <= 22) {
+            value *= POWERS_OF_TEN[exponent];
+        }
+        else if (exponent != 0) {
+            char buffer[64];
+            size_t length = std::min((size_t)(end - start), sizeof(buffer) - 1);
+            memcpy(buffer, start, length);
+            buffer[length] = '\0';
+            return (float)strtod(buffer, NULL);
+        }
+
+        return (float)(negative ? -value : value);
+    }
+
+    static inline float ParseFloatField(const char*& p, const char* end) {
+        p = SkipSpaces(p, end);
+        const char* fieldEnd = FieldEnd(p, end);
+        float value = ParseFloat(p, fieldEnd);
+        p = fieldEnd;
+        return value;
+    }
+
+    // atoi on a non terminated buffer
+    static inline int ParseInt(const char* p, const char* end) {
+        p = SkipSpaces(p, end);
+        bool negative = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            negative = *p == '-';
+            p++;
+        }
+        int value = 0;
+        for (; p < end && IsDigit(*p); p++) {
+            value = value * 10 + (*p - '0');
+        }
+        return negative ? -value : value;
+    }
+
+    static inline const char* SkipIndex(const char* p, const char* end) {
+        while (p < end && *p != '/' && !IsSpace(*p) && *p != '\r') {
+            p++;
+        }
+        return p;
+    }
+
+    // Same rules as tinyobj's fixIndex, with relative indices resolved against the chunk-local count
+    static inline int FixIndex(int index, size_t localCount, bool& relative) {
+        if (index > 0) {
+            return index - 1;
+        }
+        if (index == 0) {
+            return 0;
+        }
+        relative = true;
+        return (int)localCount + index;
+    }
+
+    static std::string ParseName(const char* p, const char* end) {
+        p = SkipSpaces(p, end);
+        return std::string(p, FieldEnd(p, end));
+    }
+
+    static void ParseFace(ObjChunk& chunk, const char* p, const char* end, bool triangulate) {
+        size_t firstCorner = chunk.corners.size();
+        size_t relativeBegin = chunk.relativeIndices.size();
+        std::vector<tinyobj::index_t> polygon;
+        polygon.reserve(4);
+
+        p = SkipSpaces(p, end);
+        while (p < end && *p != '\r') {
+            tinyobj::index_t corner;
+            corner.vertex_index = corner.normal_index = corner.texcoord_index = -1;
+            bool relative[3] = { false, false, false };
+
+            corner.vertex_index = FixIndex(ParseInt(p, end), chunk.v.size() / 3, relative[0]);
+            p = SkipIndex(p, end);
+            if (p < end && *p == '/') {
+                p++;
+                if (p < end && *p == '/') {
+                    // i//k
+                    p++;
+                    corner.normal_index = FixIndex(ParseInt(p, end), chunk.vn.size() / 3, relative[1]);
+                    p = SkipIndex(p, end);
+                }
+                else {
+                    // i/j/k or i/j
+                    corner.texcoord_index = FixIndex(ParseInt(p, end), chunk.vt.size() / 2, relative[2]);
+                    p = SkipIndex(p, end);
+                    if (p < end && *p == '/') {
+                        p++;
+                        corner.normal_index = FixIndex(ParseInt(p, end), chunk.vn.size() / 3, relative[1]);
+                        p = SkipIndex(p, end);
+                    }
+                }
+            }
+
+            for (int component = 0; component < 3; component++) {
+                if (relative[component]) {
+                    // corner position is only known once the polygon is emitted, encode the polygon slot for now
+                    chunk.relativeIndices.push_back((firstCorner + polygon.size()) * 3 + component);
+                }
+            }
+            polygon.push_back(corner);
+
+            while (p < end && (IsSpace(*p) || *p == '\r')) {
+                p++;
+            }
+        }
+
+        if (chunk.commands.empty() || chunk.commands.back().type != OBJ_FACES) {
+            ObjCommand command;
+            command.type = OBJ_FACES;
+            command.statementCount = 0;
+            command.firstFace = chunk.faceSizes.size();
+            command.faceCount = 0;
+            command.firstCorner = chunk.corners.size();
+            command.cornerCount = 0;
+            chunk.commands.push_back(command);
+        }
+        ObjCommand& faces = chunk.commands.back();
+        faces.statementCount++;
+
+        if (triangulate) {
+            // polygon -> triangle fan, exactly like tinyobj; relative slots are remapped to the fan corners
+            std::vector<size_t> polygonRelative(chunk.relativeIndices.begin() + relativeBegin, chunk.relativeIndices.end());
+            chunk.relativeIndices.resize(relativeBegin);
+
+            for (size_t k = 2; k < polygon.size(); k++) {
+                size_t fan[3] = { 0, k - 1, k };
+                for (int c = 0; c < 3; c++) {
+                    size_t cornerIndex = chunk.corners.size();
+                    chunk.corners.push_back(polygon[fan[c]]);
+                    for (size_t r = 0; r < polygonRelative.size(); r++) {
+                        if (polygonRelative[r] / 3 - firstCorner == fan[c]) {
+                            chunk.relativeIndices.push_back(cornerIndex * 3 + polygonRelative[r] % 3);
+                        }
+                    }
+                }
+                chunk.faceSizes.push_back(3);
+                faces.faceCount++;
+                faces.cornerCount += 3;
+            }
+        }
+        else {
+            chunk.corners.insert(chunk.corners.end(), polygon.begin(), polygon.end());
+            chunk.faceSizes.push_back((unsigned char)polygon.size());
+            faces.faceCount++;
+            faces.cornerCount += polygon.size();
+        }
+    }
+
+    static void PushNamedCommand(ObjChunk& chunk, ObjCommandType type, std::string name) {
+        ObjCommand command;
+        command.type = type;
+        command.name = name;
+        command.statementCount = command.firstFace = command.faceCount = command.firstCorner = command.cornerCount = 0;
+        chunk.commands.push_back(command);
+    }
+
+    static void ParseChunk(ObjChunk& chunk, bool triangulate) {
+        // rough guess so the common case never reallocates more than a couple of times
+        size_t expectedLines = (size_t)(chunk.end - chunk.begin) / 32;
+        chunk.v.reserve(expectedLines);
+        chunk.corners.reserve(expectedLines);
+
+        const char* line = chunk.begin;
+        while (line < chunk.end) {
+            const char* lineEnd = (const char*)memchr(line, '\n', (size_t)(chunk.end - line));
+            if (!lineEnd) {
+                lineEnd = chunk.end;
+            }
+            const char* next = lineEnd < chunk.end ? lineEnd + 1 : chunk.end;
+
+            const char* p = SkipSpaces(line, lineEnd);
+            size_t length = (size_t)(lineEnd - p);
+
+            if (length < 2 || *p == '#') {
+                // empty, comment or too short to be a statement
+            }
+            else if (p[0] == 'v' && IsSpace(p[1])) {
+                p += 2;
+                chunk.v.push_back(ParseFloatField(p, lineEnd));
+                chunk.v.push_back(ParseFloatField(p, lineEnd));
+                chunk.v.push_back(ParseFloatField(p, lineEnd));
+            }
+            else if (length > 2 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2])) {
+                p += 3;
+                chunk.vn.push_back(ParseFloatField(p, lineEnd));
+                chunk.vn.push_back(ParseFloatField(p, lineEnd));
+                chunk.vn.push_back(ParseFloatField(p, lineEnd));
+            }
+            else if (length > 2 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2])) {
+                p += 3;
+                chunk.vt.push_back(ParseFloatField(p, lineEnd));
+                chunk.vt.push_back(ParseFloatField(p, lineEnd));
+            }
+            else if (p[0] == 'f' && IsSpace(p[1])) {
+                ParseFace(chunk, p + 2, lineEnd, triangulate);
+            }
+            else if (length > 6 && strncmp(p, "usemtl", 6) == 0 && IsSpace(p[6])) {
+                PushNamedCommand(chunk, OBJ_USEMTL, ParseName(p + 7, lineEnd));
+            }
+            else if (length > 6 && strncmp(p, "mtllib", 6) == 0 && IsSpace(p[6])) {
+                PushNamedCommand(chunk, OBJ_MTLLIB, ParseName(p + 7, lineEnd));
+            }
+            else if (p[0] == 'g' && IsSpace(p[1])) {
+                PushNamedCommand(chunk, OBJ_GROUP, ParseName(p + 2, lineEnd));
+            }
+            else if (p[0] == 'o' && IsSpace(p[1])) {
+                PushNamedCommand(chunk, OBJ_OBJECT, ParseName(p + 2, lineEnd));
+            }
+
+            line = next;
+        }
+    }
+
+    // Face statements waiting to be attached to the current shape (tinyobj's `faceGroup`)
+    struct PendingFaces {
+        const ObjChunk* chunk;
+        const ObjCommand* command;
+    };
+
+    // Mirrors tinyobj's exportFaceGroupToShape: false when no face statement is pending
+    static bool ExportFaces(tinyobj::shape_t& shape, std::vector<PendingFaces>& pending, int material, const std::string& name) {
+        size_t statements = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            const ObjChunk& chunk = *pending[i].chunk;
+            const ObjCommand& command = *pending[i].command;
+            statements += command.statementCount;
+
+            shape.mesh.indices.insert(shape.mesh.indices.end(),
+                chunk.corners.begin() + command.firstCorner, chunk.corners.begin() + command.firstCorner + command.cornerCount);
+            shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(),
+                chunk.faceSizes.begin() + command.firstFace, chunk.faceSizes.begin() + command.firstFace + command.faceCount);
+            shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), command.faceCount, material);
+        }
+        pending.clear();
+
+        if (statements == 0) {
+            return false;
+        }
+        shape.name = name;
+        return true;
+    }
+
+    bool ObjReader::LoadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+        std::vector<tinyobj::material_t>* materials, std::string* err,
+        const char* filename, const char* mtl_basepath, bool triangulate) {
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+
+        MappedFile file;
+        if (!file.Open(filename)) {
+            if (err) {
+                (*err) += "Cannot open file [" + std::string(filename) + "]\n";
+            }
+            return false;
+        }
+
+        // cut the file into line-aligned chunks, a few per worker to even out the load
+        const char* data = (const char*)file.getData();
+        size_t size = file.getSize();
+        size_t minChunkSize = 256 * 1024;
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(size / minChunkSize, ThreadPool::getInstance().getThreadCount() * 4));
+
+        std::vector<ObjChunk> chunks(chunkCount);
+        const char* chunkBegin = data;
+        for (size_t i = 0; i < chunkCount; i++) {
+            const char* chunkEnd = data + size * (i + 1) / chunkCount;
+            if (i + 1 < chunkCount) {
+                chunkEnd = std::max(chunkEnd, chunkBegin);
+                const char* newline = (const char*)memchr(chunkEnd, '\n', (size_t)(data + size - chunkEnd));
+                chunkEnd = newline ? newline + 1 : data + size;
+            }
+            else {
+                chunkEnd = data + size;
+            }
+            chunks[i].begin = chunkBegin;
+            chunks[i].end = chunkEnd;
+            chunkBegin = chunkEnd;
+        }
+
+        std::vector<std::future<void>> parsed;
+        for (size_t i = 0; i < chunkCount; i++) {
+            ObjChunk* chunk = &chunks[i];
+            parsed.push_back(ThreadPool::getInstance().Submit([chunk, triangulate]() { ParseChunk(*chunk, triangulate); }));
+        }
+        // the parse itself may run on the pool (AssetLoader), so wait by helping with the chunks
+        for (size_t i = 0; i < parsed.size(); i++) {
+            ThreadPool::getInstance().Wait(parsed[i]);
+            parsed[i].get();
+        }
+
+        // concatenate the attribute arrays and rebase the relative indices of every chunk
+        size_t vCount = 0, vnCount = 0, vtCount = 0;
+        for (size_t i = 0; i < chunkCount; i++) {
+            ObjChunk& chunk = chunks[i];
+            for (size_t r = 0; r < chunk.relativeIndices.size(); r++) {
+                tinyobj::index_t& corner = chunk.corners[chunk.relativeIndices[r] / 3];
+                switch (chunk.relativeIndices[r] % 3) {
+                case 0: corner.vertex_index += (int)vCount; break;
+                case 1: corner.normal_index += (int)vnCount; break;
+                default: corner.texcoord_index += (int)vtCount; break;
+                }
+            }
+            vCount += chunk.v.size() / 3;
+            vnCount += chunk.vn.size() / 3;
+            vtCount += chunk.vt.size() / 2;
+        }
+        attrib->vertices.reserve(vCount * 3);
+        attrib->normals.reserve(vnCount * 3);
+        attrib->texcoords.reserve(vtCount * 2);
+        for (size_t i = 0; i < chunkCount; i++) {
+            attrib->vertices.insert(attrib->vertices.end(), chunks[i].v.begin(), chunks[i].v.end());
+            attrib->normals.insert(attrib->normals.end(), chunks[i].vn.begin(), chunks[i].vn.end());
+            attrib->texcoords.insert(attrib->texcoords.end(), chunks[i].vt.begin(), chunks[i].vt.end());
+        }
+
+        // replay the statements in file order with tinyobj's shape/material rules
+        tinyobj::MaterialFileReader materialReader(mtl_basepath ? mtl_basepath : "");
+        std::map<std::string, int> materialMap;
+        int material = -1;
+        std::string name;
+        tinyobj::shape_t shape;
+        std::vector<PendingFaces> pending;
+
+        for (size_t i = 0; i < chunkCount; i++) {
+            for (size_t c = 0; c < chunks[i].commands.size(); c++) {
+                const ObjCommand& command = chunks[i].commands[c];
+                switch (command.type) {
+                case OBJ_FACES: {
+                    PendingFaces faces = { &chunks[i], &command };
+                    pending.push_back(faces);
+                    break;
+                }
+                case OBJ_USEMTL: {
+                    std::map<std::string, int>::iterator found = materialMap.find(command.name);
+                    int newMaterial = found != materialMap.end() ? found->second : -1;
+                    if (newMaterial != material) {
+                        ExportFaces(shape, pending, material, name);
+                        material = newMaterial;
+                    }
+                    break;
+                }
+                case OBJ_MTLLIB: {
+                    std::string materialError;
+                    bool ok = materialReader(command.name, materials, &materialMap, &materialError);
+                    if (err) {
+                        (*err) += materialError;
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                    break;
+                }
+                case OBJ_GROUP:
+                case OBJ_OBJECT:
+                    if (ExportFaces(shape, pending, material, name)) {
+                        shapes->push_back(shape);
+                    }
+                    shape = tinyobj::shape_t();
+                    name = command.name;
+                    break;
+                }
+            }
+        }
+
+        if (ExportFaces(shape, pending, material, name) || shape.mesh.indices.size()) {
+            shapes->push_back(shape);
+        }
+
+        return true;
+    }
+
+    // Largest difference between two float arrays, or infinity if their sizes differ
+    static float MaxDifference(const std::vector<float>& a, const std::vector<float>& b) {
+        if (a.size() != b.size()) {
+            return INFINITY;
+        }
+        float difference = 0.0f;
+        for (size_t i = 0; i < a.size(); i++) {
+            difference = std::max(difference, std::fabs(a[i] - b[i]));
+        }
+        return difference;
+    }
+
+    static bool SameShapes(const std::vector<tinyobj::shape_t>& a, const std::vector<tinyobj::shape_t>& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t s = 0; s < a.size(); s++) {
+            const tinyobj::mesh_t& meshA = a[s].mesh;
+            const tinyobj::mesh_t& meshB = b[s].mesh;
+            if (a[s].name != b[s].name || meshA.num_face_vertices != meshB.num_face_vertices ||
+                meshA.material_ids != meshB.material_ids || meshA.indices.size() != meshB.indices.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < meshA.indices.size(); i++) {
+                if (meshA.indices[i].vertex_index != meshB.indices[i].vertex_index ||
+                    meshA.indices[i].normal_index != meshB.indices[i].normal_index ||
+                    meshA.indices[i].texcoord_index != meshB.indices[i].texcoord_index) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void ObjReader::Benchmark(std::string fileName, std::string basePath, int iterations) {
+        std::error_code error;
+        double megabytes = (double)std::filesystem::file_size(fileName, error) / (1024.0 * 1024.0);
+        if (error) {
+            std::cerr << "ERROR: could not open " << fileName << std::endl;
+            return;
+        }
+
+        tinyobj::attrib_t attribs[2];
+        std::vector<tinyobj::shape_t> shapes[2];
+        double bestSeconds[2] = { INFINITY, INFINITY };
+
+        for (int reader = 0; reader < 2; reader++) {
+            for (int i = 0; i < iterations; i++) {
+                std::vector<tinyobj::material_t> materials;
+                std::string err;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                if (reader == 0) {
+                    tinyobj::LoadObj(&attribs[reader], &shapes[reader], &materials, &err, fileName.c_str(), basePath.c_str(), true);
+                }
+                else {
+                    LoadObj(&attribs[reader], &shapes[reader], &materials, &err, fileName.c_str(), basePath.c_str(), true);
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                bestSeconds[reader] = std::min(bestSeconds[reader], seconds);
+            }
+        }
+
+        std::cout << "OBJ benchmark : " << fileName << " (" << megabytes << " MB, best of " << iterations << ")" << std::endl;
+        std::cout << "  tinyobj   : " << bestSeconds[0] * 1000.0 << " ms, " << megabytes / bestSeconds[0] << " MB/s" << std::endl;
+        std::cout << "  ObjReader : " << bestSeconds[1] * 1000.0 << " ms, " << megabytes / bestSeconds[1] << " MB/s ("
+            << ThreadPool::getInstance().getThreadCount() << " threads, " << bestSeconds[0] / bestSeconds[1] << "x)" << std::endl;
+
+        float difference = std::max(MaxDifference(attribs[0].vertices, attribs[1].vertices),
+            std::max(MaxDifference(attribs[0].normals, attribs[1].normals), MaxDifference(attribs[0].texcoords, attribs[1].texcoords)));
+        std::cout << "  same shapes : " << (SameShapes(shapes[0], shapes[1]) ? "yes" : "no")
+            << ", max attribute difference : " << difference << std::endl;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef ObjReader_hpp
+#define ObjReader_hpp
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Parallel replacement for tinyobj::LoadObj.
+    // The .obj is memory mapped and cut into line-aligned chunks that are parsed on worker threads,
+    // then the per-chunk v/vn/vt/f arrays are merged into the same attrib/shape/material structures
+    // (and the same shape splitting) that tinyobj produces. `t` (subdivision tag) lines are ignored.
+    class ObjReader
+    {
+    public:
+        static bool LoadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+            std::vector<tinyobj::material_t>* materials, std::string* err,
+            const char* filename, const char* mtl_basepath = NULL, bool triangulate = true);
+
+        // Parses `fileName` with tinyobj and with ObjReader and prints the throughput of both
+        static void Benchmark(std::string fileName, std::string basePath, int iterations = 5);
+    };
+}
+
+#endif /* ObjReader_hpp */
@@ -0,0 +1,424 @@
+#include "RenderQueue.hpp"
+#include "GLState.hpp"
+#include "GeometryArena.hpp"
+#include "InstanceBuffer.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    static_assert(PASS_COUNT <= (1 << RenderQueue::PASS_BITS), "every pass must fit in the key's pass field");
+
+    static uint64_t Field(uint64_t value, int bits) {
+        uint64_t mask = (1ull << bits) - 1;
+        return value & mask;
+    }
+
+    uint64_t RenderQueue::MakeKey(RenderPass pass, GLuint program, GLuint material, float depth) {
+        float normalized = std::min(1.0f, std::max(0.0f, depth));
+        uint64_t quantizedDepth = (uint64_t)(normalized * (float)((1u << DEPTH_BITS) - 1));
+
+        uint64_t key = Field(pass, PASS_BITS);
+        key = (key << PROGRAM_BITS) | Field(program, PROGRAM_BITS);
+        key = (key << MATERIAL_BITS) | Field(material, MATERIAL_BITS);
+        key = (key << DEPTH_BITS) | Field(quantizedDepth, DEPTH_BITS);
+        return key;
+    }
+
+    RenderQueue::RenderQueue() : indirectBuffer(0) {
+        for (int i = 0; i < PASS_COUNT; i++) {
+            drawCalls[i] = 0;
+            culled[i] = 0;
+        }
+    }
+
+    void RenderQueue::Clear() {
+        packets.clear();
+        objects.clear();
+        transforms.clear();
+        for (int i = 0; i < PASS_COUNT; i++) {
+            culled[i] = 0;
+        }
+    }
+
+    void RenderQueue::SetView(RenderPass pass, const glm::mat4& view, float farPlane) {
+        views[pass].view = view;
+        views[pass].farPlane = farPlane;
+    }
+
+    void RenderQueue::Submit(RenderPass pass, const Shader& shader, Model3D& model, const glm::mat4& transform) {
+        Object object;
+        object.firstTransform = (uint32_t)transforms.size();
+        object.transformCount = 1;
+        object.instanced = false;
+        transforms.push_back(transform);
+        SubmitObject(pass, &shader, nullptr, 0, model, object);
+    }
+
+    void RenderQueue::Submit(RenderPass pass, ShaderVariants& variants, uint32_t features, Model3D& model, const glm::mat4& transform) {
+        Object object;
+        object.firstTransform = (uint32_t)transforms.size();
+        object.transformCount = 1;
+        object.instanced = false;
+        transforms.push_back(transform);
+        SubmitObject(pass, nullptr, &variants, features, model, object);
+    }
+
+    void RenderQueue::SubmitInstanced(RenderPass pass, const Shader& shader, Model3D& model, const glm::mat4* instances, GLsizei count) {
+        if (count <= 0) {
+            return;
+        }
+        Object object;
+        object.firstTransform = (uint32_t)transforms.size();
+        object.transformCount = (uint32_t)count;
+        object.instanced = true;
+        transforms.insert(transforms.end(), instances, instances + count);
+        SubmitObject(pass, &shader, nullptr, 0, model, object);
+    }
+
+    void RenderQueue::SubmitInstanced(RenderPass pass, ShaderVariants& variants, uint32_t features, Model3D& model,
+        const glm::mat4* instances, GLsizei count) {
+        if (count <= 0) {
+            return;
+        }
+        Object object;
+        object.firstTransform = (uint32_t)transforms.size();
+        object.transformCount = (uint32_t)count;
+        object.instanced = true;
+        transforms.insert(transforms.end(), instances, instances + count);
+        SubmitObject(pass, nullptr, &variants, features, model, object);
+    }
+
+    void RenderQueue::SubmitInstanced(RenderPass pass, const Shader& shader, Model3D& model, const std::vector<glm::mat4>& instances) {
+        SubmitInstanced(pass, shader, model, instances.data(), (GLsizei)instances.size());
+    }
+
+    void RenderQueue::SubmitObject(RenderPass pass, const Shader* shader, ShaderVariants* variants, uint32_t features,
+        Model3D& model, const Object& object) {
+        uint32_t index = (uint32_t)objects.size();
+        objects.push_back(object);
+
+        std::vector<Mesh>& meshes = model.getMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            // the first texture (diffuse for every material the loader builds) stands for the material
+            GLuint material = meshes[i].textures.empty() ? 0 : meshes[i].textures[0].id;
+            float depth = ViewDepth(pass, meshes[i].bounds, object) / views[pass].farPlane;
+            const Shader* meshShader = variants ? &variants->Get(variants->MaskFor(features, meshes[i])) : shader;
+
+            DrawPacket packet;
+            packet.key = MakeKey(pass, meshShader->shaderProgram, material, depth);
+            packet.mesh = &meshes[i];
+            packet.shader = meshShader;
+            packet.object = index;
+            packet.sphere = WorldSphere(meshes[i].bounds, object);
+            packets.push_back(packet);
+        }
+    }
+
+    float RenderQueue::ViewDepth(RenderPass pass, const Bounds& bounds, const Object& object) const {
+        glm::vec4 center = glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f);
+        const glm::mat4& view = views[pass].view;
+
+        float nearest = views[pass].farPlane;
+        for (uint32_t i = 0; i < object.transformCount; i++) {
+            nearest = std::min(nearest, -(view * transforms[object.firstTransform + i] * center).z);
+        }
+        return nearest;
+    }
+
+    glm::vec4 RenderQueue::WorldSphere(const Bounds& bounds, const Object& object) const {
+        glm::vec4 sphere = TransformSphere(transforms[object.firstTransform], bounds.center, bounds.radius);
+        if (object.transformCount == 1) {
+            return sphere;
+        }
+
+        // grows around the placements' centroid until every placement fits
+        glm::vec3 centroid = glm::vec3(0.0f);
+        for (uint32_t i = 0; i < object.transformCount; i++) {
+            centroid += glm::vec3(transforms[object.firstTransform + i] * glm::vec4(bounds.center, 1.0f));
+        }
+        centroid /= (float)object.transformCount;
+        float radius = 0.0f;
+        for (uint32_t i = 0; i < object.transformCount; i++) {
+            glm::vec4 placed = TransformSphere(transforms[object.firstTransform + i], bounds.center, bounds.radius);
+            radius = std::max(radius, glm::length(glm::vec3(placed) - centroid) + placed.w);
+        }
+        return glm::vec4(centroid, radius);
+    }
+
+    RenderPass RenderQueue::PassOf(const DrawPacket& packet) {
+        return (RenderPass)(packet.key >> (PROGRAM_BITS + MATERIAL_BITS + DEPTH_BITS));
+    }
+
+    size_t RenderQueue::Cull(RenderPass pass, const glm::mat4& viewProjection) {
+        return Cull(pass, Frustum::FromMatrix(viewProjection));
+    }
+
+    size_t RenderQueue::Cull(RenderPass pass, const Frustum& frustum) {
+        return Cull(pass, &frustum, 1);
+    }
+
+    size_t RenderQueue::Cull(RenderPass pass, const Frustum* frusta, size_t count) {
+        cullX.clear();
+        cullY.clear();
+        cullZ.clear();
+        cullRadius.clear();
+        for (size_t i = 0; i < packets.size(); i++) {
+            if (PassOf(packets[i]) == pass) {
+                cullX.push_back(packets[i].sphere.x);
+                cullY.push_back(packets[i].sphere.y);
+                cullZ.push_back(packets[i].sphere.z);
+                cullRadius.push_back(packets[i].sphere.w);
+            }
+        }
+        cullVisible.resize(cullX.size());
+        cullVisibleAny.assign(cullX.size(), 0);
+
+        SphereBatch spheres;
+        spheres.centerX = cullX.data();
+        spheres.centerY = cullY.data();
+        spheres.centerZ = cullZ.data();
+        spheres.radius = cullRadius.data();
+        spheres.count = cullX.size();
+        for (size_t f = 0; f < count; f++) {
+            CullSpheres(frusta[f], spheres, cullVisible.data());
+            for (size_t i = 0; i < spheres.count; i++) {
+                cullVisibleAny[i] |= cullVisible[i];
+            }
+        }
+        size_t dropped = 0;
+        for (size_t i = 0; i < spheres.count; i++) {
+            dropped += !cullVisibleAny[i];
+        }
+        culled[pass] += dropped;
+
+        // compact in place, the other passes' packets keep their order
+        size_t kept = 0;
+        size_t tested = 0;
+        for (size_t i = 0; i < packets.size(); i++) {
+            if (PassOf(packets[i]) == pass && !cullVisibleAny[tested++]) {
+                continue;
+            }
+            packets[kept++] = packets[i];
+        }
+        packets.resize(kept);
+        return dropped;
+    }
+
+    void RenderQueue::Sort() {
+        // stable, so equal keys keep their submission order from frame to frame
+        std::stable_sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) {
+            return a.key < b.key;
+        });
+    }
+
+    void RenderQueue::PassRange(RenderPass pass, size_t& begin, size_t& end) const {
+        // compared by pass rather than by key, the key after the last pass would not fit in 64 bits
+        auto beforePass = [](const DrawPacket& packet, RenderPass pass) { return PassOf(packet) < pass; };
+        auto afterPass = [](RenderPass pass, const DrawPacket& packet) { return pass < PassOf(packet); };
+        begin = std::lower_bound(packets.begin(), packets.end(), pass, beforePass) - packets.begin();
+        end = std::upper_bound(packets.begin(), packets.end(), pass, afterPass) - packets.begin();
+    }
+
+    void RenderQueue::Execute(RenderPass pass) {
+        size_t begin, end;
+        PassRange(pass, begin, end);
+        drawCalls[pass] = 0;
+
+        ExecuteRun(pass, packets.data() + begin, end - begin);
+    }
+
+    size_t RenderQueue::Execute(RenderPass pass, const Frustum& frustum) {
+        size_t begin, end;
+        PassRange(pass, begin, end);
+        drawCalls[pass] = 0;
+
+        cullX.clear();
+        cullY.clear();
+        cullZ.clear();
+        cullRadius.clear();
+        for (size_t i = begin; i < end; i++) {
+            cullX.push_back(packets[i].sphere.x);
+            cullY.push_back(packets[i].sphere.y);
+            cullZ.push_back(packets[i].sphere.z);
+            cullRadius.push_back(packets[i].sphere.w);
+        }
+        cullVisible.resize(cullX.size());
+
+        SphereBatch spheres;
+        spheres.centerX = cullX.data();
+        spheres.centerY = cullY.data();
+        spheres.centerZ = cullZ.data();
+        spheres.radius = cullRadius.data();
+        spheres.count = cullX.size();
+        CullSpheres(frustum, spheres, cullVisible.data());
+
+        // copied rather than compacted in place, the pass is replayed against other frusta afterwards
+        visiblePackets.clear();
+        for (size_t i = begin; i < end; i++) {
+            if (cullVisible[i - begin]) {
+                visiblePackets.push_back(packets[i]);
+            }
+        }
+        ExecuteRun(pass, visiblePackets.data(), visiblePackets.size());
+        return (end - begin) - visiblePackets.size();
+    }
+
+    void RenderQueue::ExecuteRun(RenderPass pass, const DrawPacket* run, size_t count) {
+        if (GeometryArena::isMultiDrawSupported()) {
+            ExecuteIndirect(pass, run, count);
+        }
+        else {
+            ExecuteDirect(pass, run, count);
+        }
+    }
+
+    void RenderQueue::ExecuteDirect(RenderPass pass, const DrawPacket* run, size_t count) {
+        const Shader* shader = nullptr;
+        uint32_t object = UINT32_MAX;
+        for (size_t i = 0; i < count; i++) {
+            DrawPacketDirect(pass, run[i], shader, object);
+        }
+    }
+
+    bool RenderQueue::IsBatchable(const DrawPacket& packet) const {
+        return objects[packet.object].instanced && packet.mesh->isInArena();
+    }
+
+    bool RenderQueue::SameBatch(const DrawPacket& a, const DrawPacket& b) {
+        if (a.shader != b.shader || a.mesh->getIndexType() != b.mesh->getIndexType() ||
+            a.mesh->textures.size() != b.mesh->textures.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.mesh->textures.size(); i++) {
+            if (a.mesh->textures[i].id != b.mesh->textures[i].id || a.mesh->textures[i].type != b.mesh->textures[i].type) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void RenderQueue::ExecuteIndirect(RenderPass pass, const DrawPacket* run, size_t count) {
+        // one command per batchable packet, in draw order, each selecting its instances with its base instance
+        commands.clear();
+        instances.clear();
+        for (size_t i = 0; i < count; i++) {
+            const DrawPacket& packet = run[i];
+            if (!IsBatchable(packet)) {
+                continue;
+            }
+            const Object& object = objects[packet.object];
+
+            DrawElementsIndirectCommand command;
+            command.count = (GLuint)packet.mesh->getIndexCount();
+            command.instanceCount = object.transformCount;
+            command.firstIndex = packet.mesh->getFirstIndex();
+            command.baseVertex = packet.mesh->getBaseVertex();
+            command.baseInstance = (GLuint)instances.size();
+            commands.push_back(command);
+
+            for (uint32_t t = 0; t < object.transformCount; t++) {
+                instances.push_back(InstanceData::FromModel(transforms[object.firstTransform + t],
+                    packet.mesh->getPositionScale(), packet.mesh->getPositionOffset()));
+            }
+        }
+
+        if (!commands.empty()) {
+            if (indirectBuffer == 0) {
+                glGenBuffers(1, &indirectBuffer);
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+        }
+
+        const Shader* shader = nullptr;
+        uint32_t object = UINT32_MAX;
+        size_t command = 0;
+        // direct instanced draws overwrite the instance buffer, the batches after them upload again
+        bool instancesUploaded = false;
+        for (size_t i = 0; i < count;) {
+            const DrawPacket& packet = run[i];
+            if (!IsBatchable(packet)) {
+                DrawPacketDirect(pass, packet, shader, object);
+                if (objects[packet.object].instanced) {
+                    instancesUploaded = false;
+                }
+                i++;
+                continue;
+            }
+
+            size_t last = i + 1;
+            while (last < count && IsBatchable(run[last]) && SameBatch(packet, run[last])) {
+                last++;
+            }
+
+            if (!instancesUploaded) {
+                InstanceBuffer::getInstance().Upload(instances.data(), (GLsizei)instances.size());
+                instancesUploaded = true;
+            }
+            if (packet.shader != shader) {
+                shader = packet.shader;
+                object = UINT32_MAX;
+            }
+            // textures and the arena VAO, shared by the whole batch
+            packet.mesh->Bind(*shader);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, packet.mesh->getIndexType(),
+                (const GLvoid*)(command * sizeof(DrawElementsIndirectCommand)), (GLsizei)(last - i), 0);
+            drawCalls[pass]++;
+
+            command += last - i;
+            i = last;
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void RenderQueue::DrawPacketDirect(RenderPass pass, const DrawPacket& packet, const Shader*& shader, uint32_t& object) {
+        if (packet.shader != shader) {
+            shader = packet.shader;
+            shader->useShaderProgram();
+            // the new program has not seen any object's uniforms yet
+            object = UINT32_MAX;
+        }
+
+        const Object& current = objects[packet.object];
+        const glm::mat4* placements = &transforms[current.firstTransform];
+        if (current.instanced) {
+            InstanceBuffer::getInstance().Upload(placements, (GLsizei)current.transformCount,
+                packet.mesh->getPositionScale(), packet.mesh->getPositionOffset());
+            packet.mesh->DrawInstanced(*shader, (GLsizei)current.transformCount);
+            drawCalls[pass]++;
+            return;
+        }
+
+        if (packet.object != object) {
+            object = packet.object;
+            shader->setMat4(UNIFORM_MODEL, *placements);
+            if (shader->getUniformLocation(UNIFORM_NORMAL_MATRIX) != -1) {
+                shader->setMat3(UNIFORM_NORMAL_MATRIX, glm::mat3(glm::inverseTranspose(views[pass].view * (*placements))));
+            }
+        }
+        packet.mesh->Draw(*shader);
+        drawCalls[pass]++;
+    }
+
+    size_t RenderQueue::getPacketCount(RenderPass pass) const {
+        // counted one by one, the packets may not be sorted yet
+        size_t count = 0;
+        for (size_t i = 0; i < packets.size(); i++) {
+            if (PassOf(packets[i]) == pass) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    size_t RenderQueue::getDrawCallCount(RenderPass pass) const {
+        return drawCalls[pass];
+    }
+
+    size_t RenderQueue::getCulledCount(RenderPass pass) const {
+        return culled[pass];
+    }
+}
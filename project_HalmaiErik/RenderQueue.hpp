@@ -0,0 +1,155 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Frustum.hpp"
+#include "InstanceBuffer.hpp"
+#include "Mesh.hpp"
+#include "Model3D.hpp"
+#include "Shader.hpp"
+#include "ShaderVariants.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Passes in execution order, the pass is the most significant part of the sort key.
+    // PASS_SHADOW_STATIC only holds packets on the frames the cached static shadow layer is redrawn.
+    // PASS_SHADOW_POINT holds the casters of the ShadowAtlas, replayed once per cube face it redraws.
+    enum RenderPass { PASS_SHADOW_STATIC, PASS_SHADOW, PASS_SHADOW_POINT, PASS_MAIN, PASS_COUNT };
+
+    // One mesh draw: the key orders packets by pass, program, material and front-to-back depth
+    struct DrawPacket {
+        uint64_t key;
+        Mesh* mesh;
+        const Shader* shader;
+        // index into the queue's objects, shared by every mesh of one submitted model
+        uint32_t object;
+        // world space bounding sphere (xyz center, w radius) around every placement of the mesh
+        glm::vec4 sphere;
+    };
+
+    // Per frame list of draws. Objects are submitted once per pass they appear in, Sort orders every packet by
+    // its key and Execute replays a pass, setting the model uniforms only when the object changes.
+    // Instanced packets of meshes in the GeometryArena are batched: each run sharing program, material and index
+    // type becomes one glMultiDrawElementsIndirect call when the GPU has it.
+    class RenderQueue
+    {
+    public:
+        // bit layout of DrawPacket::key, from the most significant bit down
+        static const int PASS_BITS = 2;
+        static const int PROGRAM_BITS = 14;
+        static const int MATERIAL_BITS = 24;
+        static const int DEPTH_BITS = 24;
+
+        RenderQueue();
+
+        // Forgets the packets of the previous frame
+        void Clear();
+
+        // Camera the pass is drawn from: packets are ordered by their distance along its view direction, up to `farPlane`.
+        // The main pass also takes its normal matrices from it.
+        void SetView(RenderPass pass, const glm::mat4& view, float farPlane);
+
+        // Queues every mesh of `model` with one transform
+        void Submit(RenderPass pass, const Shader& shader, Model3D& model, const glm::mat4& transform);
+        // Queues every mesh of `model` once, drawn for all `instances` with an instanced shader
+        void SubmitInstanced(RenderPass pass, const Shader& shader, Model3D& model, const glm::mat4* instances, GLsizei count);
+        void SubmitInstanced(RenderPass pass, const Shader& shader, Model3D& model, const std::vector<glm::mat4>& instances);
+        // Same, each mesh drawn with the variant of `features` its material supports (ShaderVariants::MaskFor)
+        void Submit(RenderPass pass, ShaderVariants& variants, uint32_t features, Model3D& model, const glm::mat4& transform);
+        void SubmitInstanced(RenderPass pass, ShaderVariants& variants, uint32_t features, Model3D& model,
+            const glm::mat4* instances, GLsizei count);
+
+        // Drops the packets of `pass` whose bounding sphere is outside the frustum of `viewProjection`, 4 or 8
+        // spheres per SIMD test, and returns how many were dropped. Call it between the submissions and Sort.
+        size_t Cull(RenderPass pass, const glm::mat4& viewProjection);
+        size_t Cull(RenderPass pass, const Frustum& frustum);
+        // Keeps the packets inside any of the `count` frusta, e.g. the cascades of a shadow map
+        size_t Cull(RenderPass pass, const Frustum* frusta, size_t count);
+
+        void Sort();
+
+        // Draws the packets of `pass`, Sort must have been called since the last Submit
+        void Execute(RenderPass pass);
+        // Draws only the packets of `pass` whose sphere touches `frustum`, leaving the queue as it is so the pass
+        // can be replayed against another frustum. Returns how many packets it skipped.
+        size_t Execute(RenderPass pass, const Frustum& frustum);
+
+        size_t getPacketCount(RenderPass pass) const;
+        // draw calls issued by the last Execute of `pass`
+        size_t getDrawCallCount(RenderPass pass) const;
+        // packets every Cull of `pass` dropped since Clear
+        size_t getCulledCount(RenderPass pass) const;
+
+        static uint64_t MakeKey(RenderPass pass, GLuint program, GLuint material, float depth);
+
+    private:
+        // transforms[firstTransform, firstTransform + transformCount) of the queue
+        struct Object {
+            uint32_t firstTransform;
+            uint32_t transformCount;
+            bool instanced;
+        };
+
+        struct PassView {
+            glm::mat4 view = glm::mat4(1.0f);
+            float farPlane = 1.0f;
+        };
+
+        // layout glMultiDrawElementsIndirect reads
+        struct DrawElementsIndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        std::vector<DrawPacket> packets;
+        std::vector<Object> objects;
+        std::vector<glm::mat4> transforms;
+        PassView views[PASS_COUNT];
+        size_t drawCalls[PASS_COUNT];
+        size_t culled[PASS_COUNT];
+
+        // structure of arrays the culler reads, kept to avoid reallocating every frame
+        std::vector<float> cullX, cullY, cullZ, cullRadius;
+        std::vector<uint8_t> cullVisible;
+        std::vector<uint8_t> cullVisibleAny;
+        // packets of the last frustum filtered Execute
+        std::vector<DrawPacket> visiblePackets;
+
+        GLuint indirectBuffer;
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<InstanceData> instances;
+
+        // `variants` picks each mesh's program when it is set, `shader` is used otherwise
+        void SubmitObject(RenderPass pass, const Shader* shader, ShaderVariants* variants, uint32_t features,
+            Model3D& model, const Object& object);
+        // Distance of the nearest placement of `bounds` along the pass' view direction
+        float ViewDepth(RenderPass pass, const Bounds& bounds, const Object& object) const;
+        // Sphere enclosing the mesh's sphere at every placement of `object`
+        glm::vec4 WorldSphere(const Bounds& bounds, const Object& object) const;
+        static RenderPass PassOf(const DrawPacket& packet);
+
+        // Range of the sorted packets belonging to `pass`
+        void PassRange(RenderPass pass, size_t& begin, size_t& end) const;
+        // Packets an indirect batch can take
+        bool IsBatchable(const DrawPacket& packet) const;
+        // Whether `b` can join the batch `a` started
+        static bool SameBatch(const DrawPacket& a, const DrawPacket& b);
+
+        // Draws `count` sorted packets of `pass` starting at `run`
+        void ExecuteRun(RenderPass pass, const DrawPacket* run, size_t count);
+        void ExecuteDirect(RenderPass pass, const DrawPacket* run, size_t count);
+        void ExecuteIndirect(RenderPass pass, const DrawPacket* run, size_t count);
+        // Draws one packet with its own draw call
+        void DrawPacketDirect(RenderPass pass, const DrawPacket& packet, const Shader*& shader, uint32_t& object);
+    };
+}
+
+#endif /* RenderQueue_hpp */
@@ -1,13 +1,60 @@
 #include "Shader.hpp"
+#include "MappedFile.hpp"
+#include "GLState.hpp"
+
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
 
 namespace gps {
-    std::string Shader::readShaderFile(std::string fileName)
+
+    bool Shader::binaryCacheEnabled = true;
+    std::string Shader::binaryCacheDirectory = "shaders/cache/";
+
+    //deeper include chains are taken for a cycle
+    static const int MAX_INCLUDE_DEPTH = 16;
+
+    static const char PROGRAM_CACHE_MAGIC[8] = { 'G', 'P', 'S', 'P', 'R', 'O', 'G', '\0' };
+
+    //same order as StandardUniform
+    static const char* STANDARD_UNIFORM_NAMES[UNIFORM_COUNT] = {
+        "model", "normalMatrix",
+        "positionScale", "positionOffset", "octahedralNormals",
+        "ambientTexture", "diffuseTexture", "specularTexture"
+    };
+
+    //same order as UniformBlockBinding
+    static const char* UNIFORM_BLOCK_NAMES[BLOCK_COUNT] = {
+        "FrameData",
+        "ShadowAtlasData"
+    };
+
+    struct ProgramCacheHeader {
+        char magic[8];
+        uint64_t key;
+        uint32_t binaryFormat;
+        uint32_t binarySize;
+    };
+    Shader::Shader() : shaderProgram(0)
+    {
+        std::fill(standardLocations, standardLocations + UNIFORM_COUNT, -1);
+    }
+
+    std::string Shader::readShaderFile(std::string fileName, int includeDepth)
     {
         std::ifstream shaderFile;
         std::string shaderString;
 
         //open shader file
         shaderFile.open(fileName.c_str());
+        if (!shaderFile) {
+            std::cout << "ERROR: could not open shader file " << fileName << std::endl;
+            return shaderString;
+        }
 
         std::stringstream shaderStringStream;
 
@@ -17,11 +64,52 @@ namespace gps {
         //close shader file
         shaderFile.close();
 
-        //convert stream into GLchar array
-        shaderString = shaderStringStream.str();
+        //expand the includes line by line, GLSL has no #include of its own
+        std::string directory = fileName.substr(0, fileName.find_last_of("/\\") + 1);
+        std::string line;
+        while (std::getline(shaderStringStream, line)) {
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+                shaderString += line + "\n";
+                continue;
+            }
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+            if (close == std::string::npos) {
+                std::cout << "ERROR: malformed include in " << fileName << " : " << line << std::endl;
+                continue;
+            }
+            if (includeDepth >= MAX_INCLUDE_DEPTH) {
+                std::cout << "ERROR: includes nested too deep (a cycle?) in " << fileName << std::endl;
+                continue;
+            }
+            shaderString += readShaderFile(directory + line.substr(open + 1, close - open - 1), includeDepth + 1);
+        }
         return shaderString;
     }
 
+    std::string Shader::injectDefines(const std::string& source, const std::vector<std::string>& defines)
+    {
+        if (defines.empty()) {
+            return source;
+        }
+        std::string block;
+        for (const std::string& define : defines) {
+            block += "#define " + define + "\n";
+        }
+
+        //#version must stay the first statement
+        size_t version = source.find("#version");
+        if (version == std::string::npos) {
+            return block + source;
+        }
+        size_t lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos) {
+            return source + "\n" + block;
+        }
+        return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+    }
+
     void Shader::shaderCompileLog(GLuint shaderId)
     {
         GLint success;
@@ -36,7 +124,7 @@ namespace gps {
         }
     }
 
-    void Shader::shaderLinkLog(GLuint shaderProgramId)
+    bool Shader::shaderLinkLog(GLuint shaderProgramId)
     {
         GLint success;
         GLchar infoLog[512];
@@ -44,47 +132,311 @@ namespace gps {
         //check linking info
         glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
         if(!success) {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+            glGetProgramInfoLog(shaderProgramId, 512, NULL, infoLog);
             std::cout << "Shader linking error\n" << infoLog << std::endl;
         }
+        return success != 0;
+    }
+
+    uint64_t Shader::programKey(const std::string& vertexSource, const std::string& fragmentSource, const std::string& geometrySource)
+    {
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        const char* version = (const char*)glGetString(GL_VERSION);
+        std::string driver = std::string(renderer ? renderer : "") + "|" + (version ? version : "");
+
+        uint64_t hash = HashBytes(driver.data(), driver.size());
+        //every stage with its length, so no two splits of the same text share a key
+        const std::string* stages[] = { &vertexSource, &geometrySource, &fragmentSource };
+        for (const std::string* stage : stages) {
+            uint64_t size = stage->size();
+            hash = HashBytes(&size, sizeof(size), hash);
+            hash = HashBytes(stage->data(), stage->size(), hash);
+        }
+        return hash;
+    }
+
+    std::string Shader::binaryCachePath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.progbin", (unsigned long long)key);
+        return binaryCacheDirectory + name;
+    }
+
+    //returns false when there is no binary for the key or the driver rejects it
+    bool Shader::loadProgramBinary(uint64_t key)
+    {
+        std::ifstream in(binaryCachePath(key), std::ios::binary);
+        if (!in) {
+            return false;
+        }
+
+        ProgramCacheHeader header;
+        if (!in.read((char*)&header, sizeof(header)) ||
+            memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0 || header.key != key) {
+            return false;
+        }
+        std::vector<char> binary(header.binarySize);
+        if (!in.read(binary.data(), binary.size())) {
+            return false;
+        }
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, (GLenum)header.binaryFormat, binary.data(), (GLsizei)binary.size());
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            //usually a driver update, the binary is rewritten after the source compile
+            glDeleteProgram(program);
+            return false;
+        }
+
+        this->shaderProgram = program;
+        return true;
+    }
+
+    void Shader::saveProgramBinary(uint64_t key)
+    {
+        GLint binarySize = 0;
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+        if (binarySize <= 0) {
+            return;
+        }
+
+        std::vector<char> binary(binarySize);
+        GLenum binaryFormat;
+        GLsizei length = 0;
+        glGetProgramBinary(this->shaderProgram, binarySize, &length, &binaryFormat, binary.data());
+
+        ProgramCacheHeader header;
+        memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+        header.key = key;
+        header.binaryFormat = (uint32_t)binaryFormat;
+        header.binarySize = (uint32_t)length;
+
+        std::error_code error;
+        std::filesystem::create_directories(binaryCacheDirectory, error);
+
+        //same temporary file + rename as the mesh cache, a crash never leaves a truncated binary
+        std::string cachePath = binaryCachePath(key);
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            out.write((const char*)&header, sizeof(header));
+            out.write(binary.data(), length);
+            if (!out) {
+                std::cout << "WARNING: could not write shader cache " << cachePath << std::endl;
+                out.close();
+                std::filesystem::remove(tempPath, error);
+                return;
+            }
+        }
+
+        std::filesystem::rename(tempPath, cachePath, error);
+        if (error) {
+            std::cout << "WARNING: could not write shader cache " << cachePath << std::endl;
+            std::filesystem::remove(tempPath, error);
+        }
     }
 
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
+        loadShader(vertexShaderFileName, "", fragmentShaderFileName);
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName)
+    {
+        loadShader(vertexShaderFileName, geometryShaderFileName, fragmentShaderFileName, std::vector<std::string>());
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines)
+    {
+        //the defines end up in the sources, so every permutation gets its own cache key
+        std::string v = injectDefines(readShaderFile(vertexShaderFileName), defines);
+        std::string g = geometryShaderFileName.empty() ? std::string() : injectDefines(readShaderFile(geometryShaderFileName), defines);
+        std::string f = injectDefines(readShaderFile(fragmentShaderFileName), defines);
+        std::string stages = vertexShaderFileName + (g.empty() ? "" : " + " + geometryShaderFileName) + " + " + fragmentShaderFileName;
+        if (!defines.empty()) {
+            stages += " [";
+            for (size_t i = 0; i < defines.size(); i++) {
+                stages += (i > 0 ? " " : "") + defines[i];
+            }
+            stages += "]";
+        }
+
+        //drivers without any binary format cannot save programs
+        GLint binaryFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+        bool useCache = binaryCacheEnabled && binaryFormats > 0;
+        uint64_t key = useCache ? programKey(v, f, g) : 0;
+        if (useCache) {
+            if (loadProgramBinary(key)) {
+                reflectUniforms();
+                std::cout << "Shader cache hit : " << stages << std::endl;
+                return;
+            }
+            std::cout << "Shader cache miss : " << stages << ", compiling from source" << std::endl;
+        }
+
+        //read, parse and compile each stage
+        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, v);
+        GLuint geometryShader = g.empty() ? 0 : compileShader(GL_GEOMETRY_SHADER, g);
+        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, f);
 
         //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
         glAttachShader(this->shaderProgram, vertexShader);
+        if (geometryShader != 0) {
+            glAttachShader(this->shaderProgram, geometryShader);
+        }
         glAttachShader(this->shaderProgram, fragmentShader);
+        if (useCache) {
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glLinkProgram(this->shaderProgram);
         glDeleteShader(vertexShader);
+        if (geometryShader != 0) {
+            glDeleteShader(geometryShader);
+        }
         glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+        //check linking info, only working programs are cached
+        if (shaderLinkLog(this->shaderProgram) && useCache) {
+            saveProgramBinary(key);
+        }
+        reflectUniforms();
+    }
+
+    GLuint Shader::compileShader(GLenum type, const std::string& source)
+    {
+        const GLchar* shaderString = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &shaderString, NULL);
+        glCompileShader(shader);
+        //check compilation status
+        shaderCompileLog(shader);
+        return shader;
+    }
+
+    void Shader::reflectUniforms()
+    {
+        uniformLocations.clear();
+
+        GLint uniformCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+
+        for (GLint i = 0; i < uniformCount; i++) {
+            GLint size;
+            GLenum type;
+            GLsizei length;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data(), length);
+
+            //arrays are reported as "name[0]", register the bare name and every element
+            std::string::size_type bracket = name.find('[');
+            if (bracket != std::string::npos) {
+                name = name.substr(0, bracket);
+                for (GLint element = 0; element < size; element++) {
+                    std::string elementName = name + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(this->shaderProgram, elementName.c_str());
+                }
+            }
+            GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+            //uniforms inside blocks have no location
+            if (location >= 0) {
+                uniformLocations[name] = location;
+            }
+        }
+
+        for (int i = 0; i < UNIFORM_COUNT; i++) {
+            standardLocations[i] = getUniformLocation(STANDARD_UNIFORM_NAMES[i]);
+        }
+
+        //GLSL 4.10 has no layout(binding), the shared blocks are bound here
+        for (int i = 0; i < BLOCK_COUNT; i++) {
+            GLuint blockIndex = glGetUniformBlockIndex(this->shaderProgram, UNIFORM_BLOCK_NAMES[i]);
+            if (blockIndex != GL_INVALID_INDEX) {
+                glUniformBlockBinding(this->shaderProgram, blockIndex, (GLuint)i);
+            }
+        }
+    }
+
+    GLint Shader::getUniformLocation(const std::string& name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator found = uniformLocations.find(name);
+        return found != uniformLocations.end() ? found->second : -1;
+    }
+
+    GLint Shader::getUniformLocation(StandardUniform uniform) const
+    {
+        return standardLocations[uniform];
+    }
+
+    const char* Shader::getStandardUniformName(StandardUniform uniform)
+    {
+        return STANDARD_UNIFORM_NAMES[uniform];
+    }
+
+    StandardUniform Shader::findStandardUniform(const std::string& name)
+    {
+        for (int i = 0; i < UNIFORM_COUNT; i++) {
+            if (name == STANDARD_UNIFORM_NAMES[i]) {
+                return (StandardUniform)i;
+            }
+        }
+        return UNIFORM_COUNT;
+    }
+
+    void Shader::setInt(GLint location, GLint value) const
+    {
+        glUniform1i(location, value);
+    }
+
+    void Shader::setFloat(GLint location, GLfloat value) const
+    {
+        glUniform1f(location, value);
+    }
+
+    void Shader::setVec3(GLint location, const glm::vec3& value) const
+    {
+        glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+
+    void Shader::setMat3(GLint location, const glm::mat3& value) const
+    {
+        glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::setMat4(GLint location, const glm::mat4& value) const
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::setInt(StandardUniform uniform, GLint value) const
+    {
+        setInt(standardLocations[uniform], value);
+    }
+
+    void Shader::setVec3(StandardUniform uniform, const glm::vec3& value) const
+    {
+        setVec3(standardLocations[uniform], value);
+    }
+
+    void Shader::setMat3(StandardUniform uniform, const glm::mat3& value) const
+    {
+        setMat3(standardLocations[uniform], value);
+    }
+
+    void Shader::setMat4(StandardUniform uniform, const glm::mat4& value) const
+    {
+        setMat4(standardLocations[uniform], value);
     }
 
-    void Shader::useShaderProgram()
+    void Shader::useShaderProgram() const
     {
-        glUseProgram(this->shaderProgram);
+        GLState::getInstance().UseProgram(this->shaderProgram);
     }
 
 }
@@ -2,26 +2,98 @@
 #define Shader_hpp
 
 #include <GL/glew.h>
+#include "glm/glm.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
 
 namespace gps {
 
+//uniforms the engine sets on every kind of program, their locations are resolved once after linking
+enum StandardUniform {
+    UNIFORM_MODEL,
+    UNIFORM_NORMAL_MATRIX,
+    UNIFORM_POSITION_SCALE,
+    UNIFORM_POSITION_OFFSET,
+    UNIFORM_OCTAHEDRAL_NORMALS,
+    UNIFORM_AMBIENT_TEXTURE,
+    UNIFORM_DIFFUSE_TEXTURE,
+    UNIFORM_SPECULAR_TEXTURE,
+    UNIFORM_COUNT
+};
+
+//binding points of the uniform blocks shared by the programs, a block with one of these names is bound after linking
+enum UniformBlockBinding {
+    //FrameUniforms: camera and light data
+    BLOCK_FRAME_DATA,
+    //ShadowAtlas: point light shadow tiles
+    BLOCK_SHADOW_ATLAS,
+    BLOCK_COUNT
+};
+
 class Shader
 {
 public:
     GLuint shaderProgram;
+    //linked programs are saved with glGetProgramBinary and reloaded on the next start
+    static bool binaryCacheEnabled;
+    static std::string binaryCacheDirectory;
+
+    Shader();
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
-    void useShaderProgram();
+    //same with a geometry stage in between
+    void loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName);
+    //each of `defines` is #defined in every stage right after its #version line, for building permutations
+    //of one source (ShaderVariants); leave geometryShaderFileName empty for two stages
+    void loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines);
+    void useShaderProgram() const;
+
+    //location of an active uniform ("name" or "name[i]" for array elements), -1 if the program has none;
+    //a hash lookup, so resolve it once and keep the location out of per frame code
+    GLint getUniformLocation(const std::string& name) const;
+    GLint getUniformLocation(StandardUniform uniform) const;
+
+    static const char* getStandardUniformName(StandardUniform uniform);
+    //UNIFORM_COUNT when `name` is not a standard uniform
+    static StandardUniform findStandardUniform(const std::string& name);
+
+    //typed setters for the bound program, locations of -1 are ignored like glUniform does
+    void setInt(GLint location, GLint value) const;
+    void setFloat(GLint location, GLfloat value) const;
+    void setVec3(GLint location, const glm::vec3& value) const;
+    void setMat3(GLint location, const glm::mat3& value) const;
+    void setMat4(GLint location, const glm::mat4& value) const;
+    void setInt(StandardUniform uniform, GLint value) const;
+    void setVec3(StandardUniform uniform, const glm::vec3& value) const;
+    void setMat3(StandardUniform uniform, const glm::mat3& value) const;
+    void setMat4(StandardUniform uniform, const glm::mat4& value) const;
 
 private:
-    std::string readShaderFile(std::string fileName);
+    //every active uniform of the linked program
+    std::unordered_map<std::string, GLint> uniformLocations;
+    GLint standardLocations[UNIFORM_COUNT];
+
+    void reflectUniforms();
+
+    //the file with every `#include "name"` line replaced by that file, looked up next to the including one
+    std::string readShaderFile(std::string fileName, int includeDepth = 0);
+    static std::string injectDefines(const std::string& source, const std::vector<std::string>& defines);
     void shaderCompileLog(GLuint shaderId);
-    void shaderLinkLog(GLuint shaderProgramId);
+    GLuint compileShader(GLenum type, const std::string& source);
+    bool shaderLinkLog(GLuint shaderProgramId);
+
+    //hash of the sources and of the driver (GL_RENDERER, GL_VERSION) that produced the binary
+    static uint64_t programKey(const std::string& vertexSource, const std::string& fragmentSource, const std::string& geometrySource);
+    static std::string binaryCachePath(uint64_t key);
+    bool loadProgramBinary(uint64_t key);
+    void saveProgramBinary(uint64_t key);
 };
 
 }
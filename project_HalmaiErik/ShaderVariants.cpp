@@ -0,0 +1,84 @@
+#include "ShaderVariants.hpp"
+
+namespace gps {
+
+    ShaderVariants::ShaderVariants() {
+    }
+
+    void ShaderVariants::Init(const std::string& vertexShaderFileName, const std::string& geometryShaderFileName,
+        const std::string& fragmentShaderFileName, const ShaderFeature* features, int featureCount) {
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->geometryShaderFileName = geometryShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        this->features.assign(features, features + featureCount);
+        variants.clear();
+    }
+
+    const Shader& ShaderVariants::Get(uint32_t mask) {
+        // bits past the last feature select nothing
+        mask &= (1u << features.size()) - 1;
+
+        std::unordered_map<uint32_t, Shader>::iterator found = variants.find(mask);
+        if (found != variants.end()) {
+            return found->second;
+        }
+
+        std::vector<std::string> defines;
+        for (size_t i = 0; i < features.size(); i++) {
+            if (mask & (1u << i)) {
+                defines.push_back(features[i].define);
+            }
+        }
+
+        Shader& shader = variants[mask];
+        shader.loadShader(vertexShaderFileName, geometryShaderFileName, fragmentShaderFileName, defines);
+        ApplySamplers(shader);
+        return shader;
+    }
+
+    uint32_t ShaderVariants::MaskFor(uint32_t mask, const Mesh& mesh) const {
+        for (size_t i = 0; i < features.size(); i++) {
+            if ((mask & (1u << i)) && features[i].requiredTexture != nullptr && !mesh.hasTexture(features[i].requiredTexture)) {
+                mask &= ~(1u << i);
+            }
+        }
+        return mask;
+    }
+
+    void ShaderVariants::PreloadAll() {
+        for (uint32_t mask = 0; mask < (1u << features.size()); mask++) {
+            Get(mask);
+        }
+    }
+
+    void ShaderVariants::SetSampler(const std::string& name, GLint unit) {
+        bool replaced = false;
+        for (Sampler& sampler : samplers) {
+            if (sampler.name == name) {
+                sampler.unit = unit;
+                replaced = true;
+            }
+        }
+        if (!replaced) {
+            samplers.push_back({ name, unit });
+        }
+
+        for (std::unordered_map<uint32_t, Shader>::iterator it = variants.begin(); it != variants.end(); ++it) {
+            ApplySamplers(it->second);
+        }
+    }
+
+    size_t ShaderVariants::getVariantCount() const {
+        return variants.size();
+    }
+
+    void ShaderVariants::ApplySamplers(const Shader& shader) const {
+        if (samplers.empty()) {
+            return;
+        }
+        shader.useShaderProgram();
+        for (const Sampler& sampler : samplers) {
+            shader.setInt(shader.getUniformLocation(sampler.name), sampler.unit);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef ShaderVariants_hpp
+#define ShaderVariants_hpp
+
+#include <GL/glew.h>
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // One optional feature of a family of programs, #defined in the sources when it is on.
+    // With a texture type the feature also needs the mesh to have that texture, MaskFor drops it otherwise.
+    struct ShaderFeature {
+        const char* define;
+        const char* requiredTexture;
+    };
+
+    // Permutations of one set of sources, bit i of a feature mask turning features[i] on.
+    // Each mask is compiled once, on first use, and kept, so a draw can bind the cheapest program that is
+    // still correct for its material without paying for branches on features it does not have.
+    class ShaderVariants
+    {
+    public:
+        ShaderVariants();
+
+        // Sources and features of the family, nothing is compiled yet; leave geometryShaderFileName empty for two stages
+        void Init(const std::string& vertexShaderFileName, const std::string& geometryShaderFileName,
+            const std::string& fragmentShaderFileName, const ShaderFeature* features, int featureCount);
+
+        // The program with the features of `mask`, compiled now if it is the first request
+        const Shader& Get(uint32_t mask);
+        // `mask` without the features `mesh` lacks a texture for
+        uint32_t MaskFor(uint32_t mask, const Mesh& mesh) const;
+        // Compiles every combination of the features, so no variant is built in the middle of a frame
+        void PreloadAll();
+
+        // Points sampler `name` of every variant, current and future, at texture unit `unit`
+        void SetSampler(const std::string& name, GLint unit);
+
+        size_t getVariantCount() const;
+
+    private:
+        struct Sampler {
+            std::string name;
+            GLint unit;
+        };
+
+        std::string vertexShaderFileName;
+        std::string geometryShaderFileName;
+        std::string fragmentShaderFileName;
+        std::vector<ShaderFeature> features;
+        std::vector<Sampler> samplers;
+        // the map's nodes never move, so packets can keep pointers to the programs
+        std::unordered_map<uint32_t, Shader> variants;
+
+        void ApplySamplers(const Shader& shader) const;
+    };
+}
+
+#endif /* ShaderVariants_hpp */
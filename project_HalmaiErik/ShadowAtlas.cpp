@@ -0,0 +1,315 @@
+#include "ShadowAtlas.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    static_assert(sizeof(ShadowAtlasData) == SHADOW_ATLAS_MAX_LIGHTS * SHADOW_ATLAS_FACES * (64 + 16) + SHADOW_ATLAS_MAX_LIGHTS * 16,
+        "ShadowAtlasData must match the std140 layout of the ShadowAtlasData block");
+
+    // tile sides are powers of two between these
+    static const GLsizei MIN_TILE_SIZE = 128;
+    static const GLsizei MAX_TILE_SIZE = 512;
+    static const float FACE_NEAR_PLANE = 0.05f;
+
+    static const glm::vec3 FACE_DIRECTIONS[SHADOW_ATLAS_FACES] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    static const glm::vec3 FACE_UPS[SHADOW_ATLAS_FACES] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+    };
+
+    // every other bit of `value`, so a Morton index gives back its x (or, shifted by one, its y)
+    static GLint CompactBits(uint32_t value) {
+        value &= 0x55555555u;
+        value = (value | (value >> 1)) & 0x33333333u;
+        value = (value | (value >> 2)) & 0x0F0F0F0Fu;
+        value = (value | (value >> 4)) & 0x00FF00FFu;
+        value = (value | (value >> 8)) & 0x0000FFFFu;
+        return (GLint)value;
+    }
+
+    ShadowAtlas::ShadowAtlas() : size(0), texture(0), framebuffer(0), buffer(0), data(), faceRenders(0) {
+    }
+
+    void ShadowAtlas::Init(GLsizei size) {
+        this->size = size;
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        // unused texels read as far away, nothing in them casts a shadow
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowAtlasData), &data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, BLOCK_SHADOW_ATLAS, buffer);
+    }
+
+    void ShadowAtlas::MarkFaces(bool* faces, bool value) {
+        for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+            faces[face] = value;
+        }
+    }
+
+    GLsizei ShadowAtlas::TileSize(const ShadowLight& light, const glm::mat4& view, const glm::mat4& projection) const {
+        // height of the range's projection, as a fraction of the screen's
+        float distance = glm::length(glm::vec3(view * glm::vec4(light.position, 1.0f)));
+        float coverage = 1.0f;
+        if (distance > light.range) {
+            coverage = std::min(1.0f, light.range / sqrtf(distance * distance - light.range * light.range) * projection[1][1]);
+        }
+
+        GLsizei tile = MAX_TILE_SIZE;
+        while (tile > MIN_TILE_SIZE && tile / 2 >= coverage * MAX_TILE_SIZE) {
+            tile /= 2;
+        }
+        return tile;
+    }
+
+    void ShadowAtlas::Pack() {
+        const size_t cellsPerSide = size / MIN_TILE_SIZE;
+        const size_t capacity = cellsPerSide * cellsPerSide;
+
+        std::vector<size_t> order;
+        for (size_t i = 0; i < lightStates.size(); i++) {
+            if (lightStates[i].tileSize > 0) {
+                order.push_back(i);
+            }
+        }
+
+        // too many texels requested: halve the largest tiles, then drop the least important lights
+        for (;;) {
+            std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+                return lightStates[a].tileSize > lightStates[b].tileSize;
+            });
+            size_t used = 0;
+            for (size_t i : order) {
+                size_t cells = lightStates[i].tileSize / MIN_TILE_SIZE;
+                used += SHADOW_ATLAS_FACES * cells * cells;
+            }
+            if (used <= capacity) {
+                break;
+            }
+            GLsizei largest = lightStates[order.front()].tileSize;
+            if (largest > MIN_TILE_SIZE) {
+                for (size_t i : order) {
+                    if (lightStates[i].tileSize == largest) {
+                        lightStates[i].tileSize /= 2;
+                    }
+                }
+            }
+            else {
+                lightStates[order.back()].tileSize = 0;
+                order.pop_back();
+            }
+        }
+
+        // tiles in decreasing size along a Morton curve of MIN_TILE_SIZE cells: every tile starts on a multiple of
+        // its own cell count, so it covers an aligned square and nothing overlaps
+        uint32_t cursor = 0;
+        for (size_t i : order) {
+            LightState& state = lightStates[i];
+            uint32_t cells = (uint32_t)(state.tileSize / MIN_TILE_SIZE);
+            for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+                state.tileX[face] = CompactBits(cursor) * MIN_TILE_SIZE;
+                state.tileY[face] = CompactBits(cursor >> 1) * MIN_TILE_SIZE;
+                cursor += cells * cells;
+            }
+        }
+    }
+
+    void ShadowAtlas::Update(const ShadowLight* lights, int count, const glm::mat4& view, const glm::mat4& projection) {
+        count = std::min(count, SHADOW_ATLAS_MAX_LIGHTS);
+        if ((int)lightStates.size() != count) {
+            lightStates.assign(count, LightState());
+            for (LightState& state : lightStates) {
+                state.light = ShadowLight();
+                state.tileSize = 0;
+                MarkFaces(state.dirty, true);
+                MarkFaces(state.hadDynamic, false);
+                MarkFaces(state.hasDynamic, false);
+            }
+        }
+
+        // a light whose range is outside the view lights nothing on screen
+        std::vector<float> x(count), y(count), z(count), radius(count);
+        std::vector<uint8_t> visible(count);
+        for (int i = 0; i < count; i++) {
+            x[i] = lights[i].position.x;
+            y[i] = lights[i].position.y;
+            z[i] = lights[i].position.z;
+            radius[i] = lights[i].range;
+        }
+        SphereBatch spheres = { x.data(), y.data(), z.data(), radius.data(), (size_t)count };
+        CullSpheres(Frustum::FromMatrix(projection * view), spheres, visible.data());
+
+        std::vector<LightState> previous = lightStates;
+        for (int i = 0; i < count; i++) {
+            LightState& state = lightStates[i];
+            if (state.light.position != lights[i].position || state.light.range != lights[i].range) {
+                state.light = lights[i];
+                MarkFaces(state.dirty, true);
+            }
+            state.tileSize = visible[i] ? TileSize(lights[i], view, projection) : 0;
+            for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+                state.hadDynamic[face] = state.hasDynamic[face];
+                state.hasDynamic[face] = false;
+            }
+        }
+        Pack();
+
+        for (int i = 0; i < count; i++) {
+            LightState& state = lightStates[i];
+            if (state.tileSize != previous[i].tileSize || state.tileX[0] != previous[i].tileX[0] ||
+                state.tileY[0] != previous[i].tileY[0]) {
+                MarkFaces(state.dirty, true);
+            }
+        }
+
+        data = ShadowAtlasData();
+        for (int i = 0; i < count; i++) {
+            LightState& state = lightStates[i];
+            if (state.tileSize == 0) {
+                continue;
+            }
+            glm::mat4 faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, FACE_NEAR_PLANE, state.light.range);
+            float tileExtent = (float)state.tileSize / size;
+            for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+                state.faceMatrix[face] = faceProjection *
+                    glm::lookAt(state.light.position, state.light.position + FACE_DIRECTIONS[face], FACE_UPS[face]);
+                data.faceMatrix[i * SHADOW_ATLAS_FACES + face] = state.faceMatrix[face];
+                data.faceRect[i * SHADOW_ATLAS_FACES + face] = glm::vec4((float)state.tileX[face] / size,
+                    (float)state.tileY[face] / size, tileExtent, tileExtent);
+            }
+            data.lights[i] = glm::vec4(state.light.position, state.light.range);
+        }
+
+        // respecifying the whole store lets the driver hand out fresh memory instead of waiting on last frame's draws
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowAtlasData), &data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void ShadowAtlas::MarkDynamic(const glm::vec4& sphere) {
+        for (LightState& state : lightStates) {
+            if (state.tileSize == 0 || glm::length(glm::vec3(sphere) - state.light.position) >= sphere.w + state.light.range) {
+                continue;
+            }
+            // near the light the caster usually reaches one or two faces, the others keep their tiles
+            for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+                uint8_t inside = 0;
+                SphereBatch spheres = { &sphere.x, &sphere.y, &sphere.z, &sphere.w, 1 };
+                CullSpheres(Frustum::FromMatrix(state.faceMatrix[face]), spheres, &inside);
+                if (inside) {
+                    state.hasDynamic[face] = true;
+                }
+            }
+        }
+    }
+
+    void ShadowAtlas::Invalidate() {
+        for (LightState& state : lightStates) {
+            MarkFaces(state.dirty, true);
+        }
+    }
+
+    int ShadowAtlas::getFrusta(Frustum* frusta) const {
+        int count = 0;
+        for (const LightState& state : lightStates) {
+            if (state.tileSize == 0) {
+                continue;
+            }
+            for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+                frusta[count++] = Frustum::FromMatrix(state.faceMatrix[face]);
+            }
+        }
+        return count;
+    }
+
+    void ShadowAtlas::Render(RenderQueue& queue, RenderPass pass, const Shader* const* casterShaders, int shaderCount) {
+        std::vector<GLint> faceLocations(shaderCount), positionLocations(shaderCount), rangeLocations(shaderCount);
+        for (int shader = 0; shader < shaderCount; shader++) {
+            faceLocations[shader] = casterShaders[shader]->getUniformLocation("faceSpaceTrMatrix");
+            positionLocations[shader] = casterShaders[shader]->getUniformLocation("lightPosition");
+            rangeLocations[shader] = casterShaders[shader]->getUniformLocation("lightRange");
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glEnable(GL_SCISSOR_TEST);
+
+        for (LightState& state : lightStates) {
+            if (state.tileSize == 0) {
+                continue;
+            }
+
+            bool lightSet = false;
+            for (int face = 0; face < SHADOW_ATLAS_FACES; face++) {
+                if (!(state.dirty[face] || state.hasDynamic[face] || state.hadDynamic[face])) {
+                    continue;
+                }
+                if (!lightSet) {
+                    for (int shader = 0; shader < shaderCount; shader++) {
+                        casterShaders[shader]->useShaderProgram();
+                        casterShaders[shader]->setVec3(positionLocations[shader], state.light.position);
+                        casterShaders[shader]->setFloat(rangeLocations[shader], state.light.range);
+                    }
+                    lightSet = true;
+                }
+
+                glViewport(state.tileX[face], state.tileY[face], state.tileSize, state.tileSize);
+                glScissor(state.tileX[face], state.tileY[face], state.tileSize, state.tileSize);
+                glClear(GL_DEPTH_BUFFER_BIT);
+
+                for (int shader = 0; shader < shaderCount; shader++) {
+                    casterShaders[shader]->useShaderProgram();
+                    casterShaders[shader]->setMat4(faceLocations[shader], state.faceMatrix[face]);
+                }
+                // the pass was culled against all faces together, each face only draws what its own frustum holds
+                queue.Execute(pass, Frustum::FromMatrix(state.faceMatrix[face]));
+                faceRenders++;
+                state.dirty[face] = false;
+            }
+        }
+
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    GLuint ShadowAtlas::getTexture() {
+        return texture;
+    }
+
+    unsigned ShadowAtlas::getFaceRenderCount() {
+        return faceRenders;
+    }
+
+    void ShadowAtlas::Delete() {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &texture);
+        glDeleteBuffers(1, &buffer);
+        framebuffer = 0;
+        texture = 0;
+        buffer = 0;
+    }
+}
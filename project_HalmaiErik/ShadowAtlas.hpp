@@ -0,0 +1,101 @@
+#ifndef ShadowAtlas_hpp
+#define ShadowAtlas_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Frustum.hpp"
+#include "RenderQueue.hpp"
+#include "Shader.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Point lights the atlas shadows at once; the shaders declare the same count
+    const int SHADOW_ATLAS_MAX_LIGHTS = 4;
+    // one tile per cube face, +X -X +Y -Y +Z -Z
+    const int SHADOW_ATLAS_FACES = 6;
+
+    struct ShadowLight {
+        glm::vec3 position;
+        // nothing further than this is lit, or shadowed
+        float range;
+    };
+
+    // CPU copy of the ShadowAtlasData uniform block, laid out as std140
+    struct ShadowAtlasData {
+        // world to face clip space of light i's face f at [i * 6 + f]
+        glm::mat4 faceMatrix[SHADOW_ATLAS_MAX_LIGHTS * SHADOW_ATLAS_FACES];
+        // xy corner and zw size of each face's tile, in atlas texture coordinates
+        glm::vec4 faceRect[SHADOW_ATLAS_MAX_LIGHTS * SHADOW_ATLAS_FACES];
+        // xyz position, w range; a range of 0 marks a light without a tile
+        glm::vec4 lights[SHADOW_ATLAS_MAX_LIGHTS];
+    };
+
+    // Shadows of point lights packed into one depth texture: each light gets six square tiles, one per cube face,
+    // sized by how much of the screen its range covers. The tiles hold the distance to the light divided by its
+    // range, written by pointShadow.frag, and are kept from frame to frame: a light is redrawn when its tiles or the
+    // light moved, and otherwise only the faces a moving caster is (or was last frame) inside of, each face drawing
+    // just the casters its own frustum reaches.
+    class ShadowAtlas
+    {
+    public:
+        ShadowAtlas();
+
+        // Creates the size x size depth texture and the uniform buffer on BLOCK_SHADOW_ATLAS; needs a GL context
+        void Init(GLsizei size);
+
+        // Starts a frame: assigns the tiles of up to SHADOW_ATLAS_MAX_LIGHTS lights for this camera and uploads the
+        // uniform block. Lights whose range is outside the view get no tile.
+        void Update(const ShadowLight* lights, int count, const glm::mat4& view, const glm::mat4& projection);
+        // A moving caster's world bounding sphere (xyz center, w radius) for this frame, the faces it reaches are
+        // redrawn. Call it after Update, which places the faces.
+        void MarkDynamic(const glm::vec4& sphere);
+        // The static casters moved, redraw every light on the next frame
+        void Invalidate();
+
+        // Volumes of the faces of every shadowed light, for culling the casters; returns how many were written,
+        // at most SHADOW_ATLAS_MAX_LIGHTS * SHADOW_ATLAS_FACES
+        int getFrusta(Frustum* frusta) const;
+
+        // Redraws the tiles of the faces that changed from `pass` of the queue, which must be culled and sorted.
+        // `casterShaders` are the programs of that pass, they get each face's matrix before it is drawn.
+        void Render(RenderQueue& queue, RenderPass pass, const Shader* const* casterShaders, int shaderCount);
+
+        GLuint getTexture();
+        // faces drawn since Init
+        unsigned getFaceRenderCount();
+
+        void Delete();
+
+    private:
+        struct LightState {
+            ShadowLight light;
+            // tile side in texels, 0 without a tile
+            GLsizei tileSize;
+            GLint tileX[SHADOW_ATLAS_FACES];
+            GLint tileY[SHADOW_ATLAS_FACES];
+            glm::mat4 faceMatrix[SHADOW_ATLAS_FACES];
+            bool dirty[SHADOW_ATLAS_FACES];
+            // a moving caster was in the face, its shadow must be erased once it leaves
+            bool hadDynamic[SHADOW_ATLAS_FACES];
+            bool hasDynamic[SHADOW_ATLAS_FACES];
+        };
+
+        GLsizei size;
+        GLuint texture;
+        GLuint framebuffer;
+        GLuint buffer;
+        std::vector<LightState> lightStates;
+        ShadowAtlasData data;
+        unsigned faceRenders;
+
+        static void MarkFaces(bool* faces, bool value);
+        GLsizei TileSize(const ShadowLight& light, const glm::mat4& view, const glm::mat4& projection) const;
+        // places the tiles of every light, shrinking the largest until they fit
+        void Pack();
+    };
+}
+
+#endif /* ShadowAtlas_hpp */
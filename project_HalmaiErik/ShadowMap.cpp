@@ -0,0 +1,205 @@
+#include "ShadowMap.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    // blend between logarithmic (1) and uniform (0) split distances, logarithmic keeps texel density even
+    static const float CASCADE_SPLIT_LAMBDA = 0.75f;
+    // a fit covers this much more than its slice, the slice can move that far before the cascade is refitted
+    static const float CASCADE_FIT_MARGIN = 0.25f;
+
+    ShadowMap::ShadowMap() : resolution(0), staticTexture(0), staticFramebuffer(0), texture(0), framebuffer(0),
+        staticDirty(true), fitLightDirection(0.0f), fitCasterDistance(0.0f), staticRenders(0), hasDynamicCasters(false) {
+        for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+            lightSpaceTrMatrices[i] = glm::mat4(1.0f);
+            fitCenters[i] = glm::vec3(0.0f);
+            fitRadii[i] = 0.0f;
+            splits[i] = 0.0f;
+            staticLayerFramebuffers[i] = 0;
+            layerFramebuffers[i] = 0;
+        }
+    }
+
+    void ShadowMap::CreateDepthTarget(GLsizei resolution, GLuint& texture, GLuint& framebuffer, GLuint* layerFramebuffers) {
+        // create depth texture array for FBO
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+            resolution, resolution, SHADOW_CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+        // every layer attached at once, the geometry shader routes each triangle
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+        // bind nothing to color and stencil attachments
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        // blits only see the first layer of a layered attachment
+        glGenFramebuffers(SHADOW_CASCADE_COUNT, layerFramebuffers);
+        for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+            glBindFramebuffer(GL_FRAMEBUFFER, layerFramebuffers[i]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowMap::Init(GLsizei resolution) {
+        this->resolution = resolution;
+        // same format for both, the per frame copy is a depth blit
+        CreateDepthTarget(resolution, staticTexture, staticFramebuffer, staticLayerFramebuffers);
+        CreateDepthTarget(resolution, texture, framebuffer, layerFramebuffers);
+        staticDirty = true;
+        // the texel snapping depends on the resolution
+        for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+            fitRadii[i] = 0.0f;
+        }
+    }
+
+    void ShadowMap::UpdateCascades(const glm::mat4& view, float fovy, float aspect, float near, float shadowDistance,
+        const glm::vec3& lightDirection, float casterDistance) {
+        glm::mat4 inverseView = glm::inverse(view);
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = fabsf(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        float tanHalfFovy = tanf(fovy * 0.5f);
+        bool lightChanged = direction != fitLightDirection || casterDistance != fitCasterDistance;
+        fitLightDirection = direction;
+        fitCasterDistance = casterDistance;
+
+        float sliceNear = near;
+        for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+            float fraction = (float)(i + 1) / SHADOW_CASCADE_COUNT;
+            float logarithmic = near * powf(shadowDistance / near, fraction);
+            float uniform = near + (shadowDistance - near) * fraction;
+            float sliceFar = CASCADE_SPLIT_LAMBDA * logarithmic + (1.0f - CASCADE_SPLIT_LAMBDA) * uniform;
+            splits[i] = sliceFar;
+
+            // bounding sphere of the slice's corners, its size does not change as the camera turns
+            glm::vec3 corners[8];
+            glm::vec3 center = glm::vec3(0.0f);
+            for (int c = 0; c < 8; c++) {
+                float depth = (c & 4) ? sliceFar : sliceNear;
+                float halfHeight = depth * tanHalfFovy;
+                glm::vec4 corner = glm::vec4((c & 1) ? halfHeight * aspect : -halfHeight * aspect,
+                    (c & 2) ? halfHeight : -halfHeight, -depth, 1.0f);
+                corners[c] = glm::vec3(inverseView * corner);
+                center += corners[c];
+            }
+            center /= 8.0f;
+            float radius = 0.0f;
+            for (int c = 0; c < 8; c++) {
+                radius = std::max(radius, glm::length(corners[c] - center));
+            }
+            radius = ceilf(radius * 16.0f) / 16.0f;
+            sliceNear = sliceFar;
+
+            // keep the previous fit while the slice is still inside it, so the matrix and the cached static layer
+            // stay the same as the camera moves and turns a little
+            float fitRadius = radius * (1.0f + CASCADE_FIT_MARGIN);
+            if (!lightChanged && fitRadii[i] == fitRadius && glm::length(center - fitCenters[i]) + radius <= fitRadius) {
+                continue;
+            }
+            fitCenters[i] = center;
+            fitRadii[i] = fitRadius;
+            staticDirty = true;
+
+            glm::mat4 lightView = glm::lookAt(center - direction * (fitRadius + casterDistance), center, up);
+            glm::mat4 lightProjection = glm::ortho(-fitRadius, fitRadius, -fitRadius, fitRadius, 0.0f, 2.0f * fitRadius + casterDistance);
+
+            // move the projection by less than a texel so the world origin lands on a texel corner,
+            // texels then stay put while the camera moves and shadow edges do not shimmer
+            glm::mat4 lightSpace = lightProjection * lightView;
+            float texelsPerUnit = resolution * 0.5f;
+            glm::vec4 origin = lightSpace * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            float offsetX = (roundf(origin.x * texelsPerUnit) - origin.x * texelsPerUnit) / texelsPerUnit;
+            float offsetY = (roundf(origin.y * texelsPerUnit) - origin.y * texelsPerUnit) / texelsPerUnit;
+            lightProjection[3][0] += offsetX;
+            lightProjection[3][1] += offsetY;
+
+            lightSpaceTrMatrices[i] = lightProjection * lightView;
+        }
+    }
+
+    const glm::mat4& ShadowMap::getLightSpaceTrMatrix(int cascade) const {
+        return lightSpaceTrMatrices[cascade];
+    }
+
+    float ShadowMap::getSplit(int cascade) const {
+        return splits[cascade];
+    }
+
+    void ShadowMap::getFrusta(Frustum* frusta) const {
+        for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+            frusta[i] = Frustum::FromMatrix(lightSpaceTrMatrices[i]);
+        }
+    }
+
+    void ShadowMap::InvalidateStatic() {
+        staticDirty = true;
+    }
+
+    bool ShadowMap::isStaticDirty() const {
+        return staticDirty;
+    }
+
+    void ShadowMap::Render(RenderQueue& queue) {
+        glViewport(0, 0, resolution, resolution);
+
+        bool staticRedrawn = false;
+        if (isStaticDirty()) {
+            glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            queue.Execute(PASS_SHADOW_STATIC);
+            staticDirty = false;
+            staticRenders++;
+            staticRedrawn = true;
+        }
+
+        // nothing moved into or out of the map since the last copy, it is still valid
+        bool dynamicCasters = queue.getPacketCount(PASS_SHADOW) > 0;
+        if (staticRedrawn || dynamicCasters || hasDynamicCasters) {
+            for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, staticLayerFramebuffers[i]);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layerFramebuffers[i]);
+                glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            }
+
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            queue.Execute(PASS_SHADOW);
+            hasDynamicCasters = dynamicCasters;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    GLuint ShadowMap::getTexture() {
+        return texture;
+    }
+
+    unsigned ShadowMap::getStaticRenderCount() {
+        return staticRenders;
+    }
+
+    void ShadowMap::Delete() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(SHADOW_CASCADE_COUNT, staticLayerFramebuffers);
+        glDeleteFramebuffers(SHADOW_CASCADE_COUNT, layerFramebuffers);
+        glDeleteFramebuffers(1, &staticFramebuffer);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &staticTexture);
+        glDeleteTextures(1, &texture);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef ShadowMap_hpp
+#define ShadowMap_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "FrameUniforms.hpp"
+#include "Frustum.hpp"
+#include "RenderQueue.hpp"
+
+namespace gps {
+
+    // Cascaded directional light shadows: the camera frustum up to the shadow distance is split into
+    // SHADOW_CASCADE_COUNT slices, each with a light projection fitted around it, rendered in one layered pass
+    // into a depth texture array (depthMapShader.geom picks the layer).
+    // Each layer is built from two parts: the static casters drawn once into a cached array (PASS_SHADOW_STATIC),
+    // and the moving casters (PASS_SHADOW) drawn every frame over a copy of it. A cascade covers its slice with
+    // some margin and is only refitted once the slice leaves it (or the light turns), so the cache is redrawn
+    // when the camera has moved or turned far enough, not on every frame it is not perfectly still.
+    class ShadowMap
+    {
+    public:
+        ShadowMap();
+
+        // Creates both depth arrays, `resolution` squared per cascade; needs a GL context
+        void Init(GLsizei resolution);
+
+        // Splits [near, shadowDistance] of the camera between the cascades and fits a light projection around
+        // each slice that left its previous fit, keeping `casterDistance` towards the light for casters outside the view
+        void UpdateCascades(const glm::mat4& view, float fovy, float aspect, float near, float shadowDistance,
+            const glm::vec3& lightDirection, float casterDistance);
+
+        const glm::mat4& getLightSpaceTrMatrix(int cascade) const;
+        // view space distance where the cascade ends
+        float getSplit(int cascade) const;
+        // Volumes of every cascade, for culling the casters
+        void getFrusta(Frustum* frusta) const;
+
+        // The static casters moved, redraw them on the next frame
+        void InvalidateStatic();
+        // Whether the next Render redraws the static layer, so the static casters only need submitting then
+        bool isStaticDirty() const;
+
+        // Brings the texture up to date for this frame; the queue must be culled and sorted
+        void Render(RenderQueue& queue);
+
+        // The composed GL_TEXTURE_2D_ARRAY the lighting samples
+        GLuint getTexture();
+        // times the static layer was drawn
+        unsigned getStaticRenderCount();
+
+        void Delete();
+
+    private:
+        GLsizei resolution;
+        glm::mat4 lightSpaceTrMatrices[SHADOW_CASCADE_COUNT];
+        float splits[SHADOW_CASCADE_COUNT];
+
+        // layered framebuffers for drawing, one framebuffer per layer for the copies
+        GLuint staticTexture;
+        GLuint staticFramebuffer;
+        GLuint staticLayerFramebuffers[SHADOW_CASCADE_COUNT];
+        GLuint texture;
+        GLuint framebuffer;
+        GLuint layerFramebuffers[SHADOW_CASCADE_COUNT];
+
+        bool staticDirty;
+        // what each cascade was last fitted around; a radius of 0 means never
+        glm::vec3 fitCenters[SHADOW_CASCADE_COUNT];
+        float fitRadii[SHADOW_CASCADE_COUNT];
+        glm::vec3 fitLightDirection;
+        float fitCasterDistance;
+        unsigned staticRenders;
+        // the texture holds more than the static layer, moving casters were drawn into it
+        bool hasDynamicCasters;
+
+        static void CreateDepthTarget(GLsizei resolution, GLuint& texture, GLuint& framebuffer, GLuint* layerFramebuffers);
+    };
+}
+
+#endif /* ShadowMap_hpp */
@@ -7,6 +7,7 @@
 //
 
 #include "SkyBox.hpp"
+#include "GLState.hpp"
 
 namespace gps {
     
@@ -17,52 +18,69 @@ namespace gps {
     
     void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
     {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
+        // all six faces decode in parallel
+        std::vector<std::shared_future<Image>> faceImages;
+        for (size_t i = 0; i < cubeMapFaces.size(); i++) {
+            faceImages.push_back(DecodeFaceAsync(cubeMapFaces[i]));
+        }
+        Upload(faceImages);
+    }
+    
+    std::shared_future<Image> SkyBox::DecodeFaceAsync(const GLchar* cubeMapFace, std::function<void()> onDecoded)
+    {
+        int force_channels = 3;
+        // the cube map samples without mipmaps, so only the top level is compressed
+        return TextureDecoder::getInstance().Decode(cubeMapFace, force_channels, false, onDecoded,
+            TextureCompressor::getEffectiveCompression(), false);
+    }
+    
+    void SkyBox::Upload(const std::vector<std::shared_future<Image>>& faceImages)
+    {
+        cubemapTexture = LoadSkyBoxTextures(faceImages);
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(const gps::Shader& shader)
     {
         shader.useShaderProgram();
+        if (samplerProgram != shader.shaderProgram) {
+            samplerProgram = shader.shaderProgram;
+            samplerLoc = shader.getUniformLocation("skybox");
+        }
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-        
-        glDepthFunc(GL_LEQUAL);
+        GLState& state = GLState::getInstance();
+        state.SetDepthFunc(GL_LEQUAL);
         
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        state.BindVertexArray(skyboxVAO);
+        shader.setInt(samplerLoc, 0);
+        state.BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
         
-        glDepthFunc(GL_LESS);
+        state.SetDepthFunc(GL_LESS);
     }
     
-    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
+    GLuint SkyBox::LoadSkyBoxTextures(const std::vector<std::shared_future<Image>>& faceImages)
     {
         GLuint textureID;
         glGenTextures(1, &textureID);
         glActiveTexture(GL_TEXTURE0);
         
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
+        for(GLuint i = 0; i < faceImages.size(); i++)
         {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
+            // a face that failed to decode was already reported by DecodeImage
+            const Image& face = faceImages[i].get();
+            if (!face.isValid()) {
                 return false;
             }
+            if (face.compressed) {
+                std::string faceName = "skybox face " + std::to_string(i);
+                TextureCompressor::Upload(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, *face.compressed, false, faceName.c_str());
+                continue;
+            }
             glTexImage2D(
                          GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
+                         GL_RGB, face.width, face.height, 0, GL_RGB, GL_UNSIGNED_BYTE, face.pixels.get()
                          );
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -13,6 +13,8 @@
 #include "Shader.hpp"
 #include <vector>
 #include "stb_image.h"
+#include "Image.hpp"
+#include "TextureDecoder.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
@@ -22,13 +24,21 @@ namespace gps {
     public:
         SkyBox();
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // Queues the decode of one cube map face on the TextureDecoder pool
+        static std::shared_future<Image> DecodeFaceAsync(const GLchar* cubeMapFace, std::function<void()> onDecoded = nullptr);
+        // Creates the cube map from decoded faces, uploading each one as soon as it is ready
+        void Upload(const std::vector<std::shared_future<Image>>& faceImages);
+        // view and projection come from the FrameData uniform block
+        void Draw(const gps::Shader& shader);
         GLuint GetTextureId();
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        // sampler location, resolved again only when drawn with another program
+        GLuint samplerProgram = 0;
+        GLint samplerLoc = -1;
+        GLuint LoadSkyBoxTextures(const std::vector<std::shared_future<Image>>& faceImages);
         void InitSkyBox();
     };
 }
@@ -0,0 +1,169 @@
+#include "TextureCache.hpp"
+#include "TextureCompressor.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+
+namespace gps {
+
+    TextureCache& TextureCache::getInstance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    std::string TextureCache::CanonicalPath(std::string path) {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(std::filesystem::path(path), error);
+        if (error) {
+            canonical = std::filesystem::absolute(std::filesystem::path(path), error).lexically_normal();
+        }
+
+        std::string key = canonical.generic_string();
+#ifdef _WIN32
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#endif
+        return key;
+    }
+
+    uint64_t TextureCache::HashImage(const Image& image) {
+        int dimensions[3] = { image.width, image.height, image.channels };
+        uint64_t hash = HashBytes(dimensions, sizeof(dimensions));
+        if (!image.pixels) {
+            // compressed images and mip chains only keep their levels, the top one identifies them just as well
+            const std::vector<unsigned char>& top = image.compressed ? image.compressed->levels[0] : image.mips->levels[0];
+            return HashBytes(top.data(), top.size(), hash);
+        }
+        return HashBytes(image.pixels.get(), image.getSize(), hash);
+    }
+
+    GLuint TextureCache::Acquire(std::string path, std::function<Image()> decode, std::function<GLuint(const Image&)> upload) {
+        std::string key = CanonicalPath(path);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unordered_map<std::string, GLuint>::iterator found = texturesByPath.find(key);
+            if (found != texturesByPath.end()) {
+                entries[found->second].references++;
+                return found->second;
+            }
+        }
+
+        // every exit from here drops the pending decode, its future would keep the pixels alive for the whole run
+        Image image = decode();
+        if (!image.isValid()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingDecodes.erase(key);
+            return 0;
+        }
+
+        uint64_t contentHash = matchContents ? HashImage(image) : 0;
+        if (matchContents) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unordered_map<uint64_t, GLuint>::iterator found = texturesByContent.find(contentHash);
+            if (found != texturesByContent.end()) {
+                Entry& entry = entries[found->second];
+                entry.references++;
+                entry.paths.push_back(key);
+                texturesByPath[key] = found->second;
+                pendingDecodes.erase(key);
+                return found->second;
+            }
+        }
+
+        GLuint textureId = upload(image);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingDecodes.erase(key);
+        if (textureId == 0) {
+            return 0;
+        }
+
+        Entry entry;
+        entry.references = 1;
+        entry.contentHash = contentHash;
+        entry.paths.push_back(key);
+        entries[textureId] = entry;
+        texturesByPath[key] = textureId;
+        if (matchContents) {
+            texturesByContent[contentHash] = textureId;
+        }
+        return textureId;
+    }
+
+    void TextureCache::Release(GLuint textureId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<GLuint, Entry>::iterator found = entries.find(textureId);
+        if (found == entries.end() || --found->second.references > 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < found->second.paths.size(); i++) {
+            texturesByPath.erase(found->second.paths[i]);
+        }
+        std::unordered_map<uint64_t, GLuint>::iterator content = texturesByContent.find(found->second.contentHash);
+        if (content != texturesByContent.end() && content->second == textureId) {
+            texturesByContent.erase(content);
+        }
+        entries.erase(found);
+
+        glDeleteTextures(1, &textureId);
+    }
+
+    std::shared_future<Image> TextureCache::DecodeAsync(std::string path,
+        std::function<std::shared_future<Image>(std::function<void()>)> startDecode, std::function<void()> onDecoded) {
+        std::string key = CanonicalPath(path);
+        // the lookup, the insert and the start of the decode share one critical section, so two loaders asking
+        // for the same path cannot both miss and decode it twice
+        std::unique_lock<std::mutex> lock(mutex);
+        if (texturesByPath.find(key) != texturesByPath.end()) {
+            lock.unlock();
+            if (onDecoded) {
+                onDecoded();
+            }
+            return std::shared_future<Image>();
+        }
+
+        std::unordered_map<std::string, std::shared_ptr<PendingDecode>>::iterator found = pendingDecodes.find(key);
+        if (found != pendingDecodes.end()) {
+            std::shared_ptr<PendingDecode> pending = found->second;
+            if (!pending->decoded) {
+                if (onDecoded) {
+                    pending->listeners.push_back(onDecoded);
+                }
+                return pending->image;
+            }
+            lock.unlock();
+            if (onDecoded) {
+                onDecoded();
+            }
+            return pending->image;
+        }
+
+        std::shared_ptr<PendingDecode> pending = std::make_shared<PendingDecode>();
+        pending->decoded = false;
+        if (onDecoded) {
+            pending->listeners.push_back(onDecoded);
+        }
+
+        // the lock is held while the decode starts, so its completion cannot run before `image` is stored
+        pendingDecodes[key] = pending;
+        pending->image = startDecode([this, pending]() {
+            std::vector<std::function<void()>> listeners;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending->decoded = true;
+                listeners.swap(pending->listeners);
+            }
+            for (size_t i = 0; i < listeners.size(); i++) {
+                listeners[i]();
+            }
+        });
+        return pending->image;
+    }
+
+    size_t TextureCache::getTextureCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include <GL/glew.h>
+
+#include "Image.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Reference counted GL textures shared by every model, keyed by canonical path
+    // and, optionally, by a hash of the decoded pixels
+    class TextureCache
+    {
+    public:
+        static TextureCache& getInstance();
+
+        // identical images stored under different paths share one texture; off by default, the hash reads every
+        // decoded image in full on the GL thread
+        bool matchContents = false;
+
+        // Key of a texture path: absolute, normalized, with '/' separators (and lower case on Windows)
+        static std::string CanonicalPath(std::string path);
+
+        // Returns the texture of `path` with one more reference. Only when it is not cached yet, `decode`
+        // is called and, unless matchContents finds the same pixels under another path, `upload` too.
+        // Must be called on the GL thread, returns 0 if the image cannot be decoded.
+        GLuint Acquire(std::string path, std::function<Image()> decode, std::function<GLuint(const Image&)> upload);
+
+        // Drops one reference, the texture is deleted with the last one
+        void Release(GLuint textureId);
+
+        // Shares decodes between loaders: `startDecode` only runs if `path` is neither uploaded nor already
+        // being decoded. `onDecoded` runs once the pixels are ready, right away if they already are.
+        // The future is invalid when the texture is already uploaded.
+        std::shared_future<Image> DecodeAsync(std::string path,
+            std::function<std::shared_future<Image>(std::function<void()>)> startDecode, std::function<void()> onDecoded);
+
+        size_t getTextureCount();
+
+    private:
+        struct Entry {
+            unsigned references;
+            uint64_t contentHash;
+            std::vector<std::string> paths;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<std::string, GLuint> texturesByPath;
+        std::unordered_map<uint64_t, GLuint> texturesByContent;
+        std::unordered_map<GLuint, Entry> entries;
+
+        struct PendingDecode {
+            std::shared_future<Image> image;
+            bool decoded;
+            std::vector<std::function<void()>> listeners;
+        };
+        // decodes started by DecodeAsync, dropped once Acquire uploads the texture
+        std::unordered_map<std::string, std::shared_ptr<PendingDecode>> pendingDecodes;
+
+        static uint64_t HashImage(const Image& image);
+    };
+}
+
+#endif /* TextureCache_hpp */
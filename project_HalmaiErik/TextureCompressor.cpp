@@ -0,0 +1,585 @@
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    TextureCompression TextureCompressor::compression = TEXTURE_BC1_BC3;
+    std::atomic<uint64_t> TextureCompressor::bytesSaved(0);
+
+    // The 16 texels of a block as planar float channels, the layout the SIMD kernels work on
+    struct BlockPixels {
+        alignas(16) float channels[4][16];
+    };
+
+    // Weight of the first endpoint for each BC1 index
+    static const float BC1_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    // BC7 4-bit index interpolation weights (out of 64) of the second endpoint
+    static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    size_t CompressedImage::getSize() const {
+        size_t size = 0;
+        for (size_t i = 0; i < levels.size(); i++) {
+            size += levels[i].size();
+        }
+        return size;
+    }
+
+    size_t CompressedImage::getUncompressedSize() const {
+        size_t size = 0;
+        int w = width;
+        int h = height;
+        for (size_t i = 0; i < levels.size(); i++) {
+            size += (size_t)w * h * 4;
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+        return size;
+    }
+
+    static void LoadBlock(const unsigned char* rgba, BlockPixels& block) {
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 4; c++) {
+                block.channels[c][i] = (float)rgba[i * 4 + c];
+            }
+        }
+    }
+
+    // Per channel mean, minimum and maximum over the block
+    static void ChannelStats(const BlockPixels& block, int firstChannel, int channelCount, float* mean, float* minimum, float* maximum) {
+        for (int c = firstChannel; c < firstChannel + channelCount; c++) {
+#ifdef GPS_SSE2
+            __m128 sum = _mm_load_ps(&block.channels[c][0]);
+            __m128 low = sum;
+            __m128 high = sum;
+            for (int i = 4; i < 16; i += 4) {
+                __m128 texels = _mm_load_ps(&block.channels[c][i]);
+                sum = _mm_add_ps(sum, texels);
+                low = _mm_min_ps(low, texels);
+                high = _mm_max_ps(high, texels);
+            }
+            alignas(16) float sums[4], lows[4], highs[4];
+            _mm_store_ps(sums, sum);
+            _mm_store_ps(lows, low);
+            _mm_store_ps(highs, high);
+            mean[c] = (sums[0] + sums[1] + sums[2] + sums[3]) / 16.0f;
+            minimum[c] = std::min(std::min(lows[0], lows[1]), std::min(lows[2], lows[3]));
+            maximum[c] = std::max(std::max(highs[0], highs[1]), std::max(highs[2], highs[3]));
+#else
+            float sum = 0.0f;
+            minimum[c] = FLT_MAX;
+            maximum[c] = -FLT_MAX;
+            for (int i = 0; i < 16; i++) {
+                sum += block.channels[c][i];
+                minimum[c] = std::min(minimum[c], block.channels[c][i]);
+                maximum[c] = std::max(maximum[c], block.channels[c][i]);
+            }
+            mean[c] = sum / 16.0f;
+#endif
+        }
+    }
+
+    // Nearest palette entry (over channels [firstChannel, firstChannel + channelCount)) for every texel;
+    // returns the summed squared error
+    static float SelectIndices(const BlockPixels& block, int firstChannel, int channelCount,
+        const float (*palette)[4], int paletteSize, unsigned char* indices) {
+#ifdef GPS_SSE2
+        alignas(16) int32_t bestIndices[16];
+        __m128 totalError = _mm_setzero_ps();
+        for (int group = 0; group < 16; group += 4) {
+            __m128 bestDistance = _mm_set1_ps(FLT_MAX);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (int p = 0; p < paletteSize; p++) {
+                __m128 distance = _mm_setzero_ps();
+                for (int c = firstChannel; c < firstChannel + channelCount; c++) {
+                    __m128 difference = _mm_sub_ps(_mm_load_ps(&block.channels[c][group]), _mm_set1_ps(palette[p][c]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(difference, difference));
+                }
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, bestDistance));
+                bestDistance = _mm_min_ps(distance, bestDistance);
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+            }
+            _mm_store_si128((__m128i*)&bestIndices[group], bestIndex);
+            totalError = _mm_add_ps(totalError, bestDistance);
+        }
+
+        alignas(16) float errors[4];
+        _mm_store_ps(errors, totalError);
+        for (int i = 0; i < 16; i++) {
+            indices[i] = (unsigned char)bestIndices[i];
+        }
+        return errors[0] + errors[1] + errors[2] + errors[3];
+#else
+        float totalError = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            float bestDistance = FLT_MAX;
+            for (int p = 0; p < paletteSize; p++) {
+                float distance = 0.0f;
+                for (int c = firstChannel; c < firstChannel + channelCount; c++) {
+                    float difference = block.channels[c][i] - palette[p][c];
+                    distance += difference * difference;
+                }
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    indices[i] = (unsigned char)p;
+                }
+            }
+            totalError += bestDistance;
+        }
+        return totalError;
+#endif
+    }
+
+    // Endpoints at the two texels that lie furthest apart along the principal axis of the block's colors
+    static void PrincipalEndpoints(const BlockPixels& block, int channelCount, float* low, float* high) {
+        float mean[4], minimum[4], maximum[4];
+        ChannelStats(block, 0, channelCount, mean, minimum, maximum);
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++) {
+            float offset[4];
+            for (int c = 0; c < channelCount; c++) {
+                offset[c] = block.channels[c][i] - mean[c];
+            }
+            for (int a = 0; a < channelCount; a++) {
+                for (int b = a; b < channelCount; b++) {
+                    covariance[a][b] += offset[a] * offset[b];
+                }
+            }
+        }
+
+        // power iteration, starting from the covariance column of the channel that varies most
+        int widest = 0;
+        for (int c = 0; c < channelCount; c++) {
+            for (int d = 0; d < c; d++) {
+                covariance[c][d] = covariance[d][c];
+            }
+            if (covariance[c][c] > covariance[widest][widest]) {
+                widest = c;
+            }
+        }
+        float axis[4];
+        for (int c = 0; c < channelCount; c++) {
+            axis[c] = covariance[c][widest];
+        }
+        for (int iteration = 0; iteration < 8; iteration++) {
+            float next[4];
+            float largest = 0.0f;
+            for (int a = 0; a < channelCount; a++) {
+                next[a] = 0.0f;
+                for (int b = 0; b < channelCount; b++) {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                largest = std::max(largest, fabsf(next[a]));
+            }
+            if (largest == 0.0f) {
+                break;
+            }
+            for (int c = 0; c < channelCount; c++) {
+                axis[c] = next[c] / largest;
+            }
+        }
+
+        int lowTexel = 0;
+        int highTexel = 0;
+        float lowProjection = FLT_MAX;
+        float highProjection = -FLT_MAX;
+        for (int i = 0; i < 16; i++) {
+            float projection = 0.0f;
+            for (int c = 0; c < channelCount; c++) {
+                projection += block.channels[c][i] * axis[c];
+            }
+            if (projection < lowProjection) {
+                lowProjection = projection;
+                lowTexel = i;
+            }
+            if (projection > highProjection) {
+                highProjection = projection;
+                highTexel = i;
+            }
+        }
+
+        for (int c = 0; c < 4; c++) {
+            low[c] = block.channels[c][lowTexel];
+            high[c] = block.channels[c][highTexel];
+        }
+    }
+
+    // Least squares endpoints for fixed indices; weights[index] is the weight of the first endpoint
+    static bool RefineEndpoints(const BlockPixels& block, int channelCount, const unsigned char* indices, const float* weights,
+        float* first, float* second) {
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+            float a = weights[indices[i]];
+            float b = 1.0f - a;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            for (int c = 0; c < channelCount; c++) {
+                ax[c] += a * block.channels[c][i];
+                bx[c] += b * block.channels[c][i];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (fabsf(determinant) < 1e-6f) {
+            return false;
+        }
+        for (int c = 0; c < channelCount; c++) {
+            first[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / determinant));
+            second[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / determinant));
+        }
+        return true;
+    }
+
+    static uint16_t PackRGB565(const float* color) {
+        int r = (int)lroundf(color[0] * 31.0f / 255.0f);
+        int g = (int)lroundf(color[1] * 63.0f / 255.0f);
+        int b = (int)lroundf(color[2] * 31.0f / 255.0f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    static void UnpackRGB565(uint16_t packed, float* color) {
+        int r = (packed >> 11) & 31;
+        int g = (packed >> 5) & 63;
+        int b = packed & 31;
+        color[0] = (float)((r << 3) | (r >> 2));
+        color[1] = (float)((g << 2) | (g >> 4));
+        color[2] = (float)((b << 3) | (b >> 2));
+        color[3] = 255.0f;
+    }
+
+    // Quantizes two endpoints to 565 in four color order (c0 > c1) and picks the indices
+    static float FitColorEndpoints(const BlockPixels& block, const float* a, const float* b,
+        uint16_t& c0, uint16_t& c1, unsigned char* indices) {
+        c0 = PackRGB565(a);
+        c1 = PackRGB565(b);
+        if (c0 < c1) {
+            std::swap(c0, c1);
+        }
+
+        float palette[4][4];
+        UnpackRGB565(c0, palette[0]);
+        if (c0 == c1) {
+            // a single color, every texel uses index 0
+            return SelectIndices(block, 0, 3, palette, 1, indices);
+        }
+        UnpackRGB565(c1, palette[1]);
+        for (int c = 0; c < 4; c++) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        return SelectIndices(block, 0, 3, palette, 4, indices);
+    }
+
+    static void EncodeColorBlock(const BlockPixels& block, unsigned char* out) {
+        float low[4], high[4];
+        PrincipalEndpoints(block, 3, low, high);
+
+        uint16_t c0, c1;
+        unsigned char indices[16];
+        float error = FitColorEndpoints(block, high, low, c0, c1, indices);
+
+        // one least squares pass over the endpoints for the chosen indices
+        float first[4], second[4];
+        if (c0 != c1 && RefineEndpoints(block, 3, indices, BC1_WEIGHTS, first, second)) {
+            uint16_t refined0, refined1;
+            unsigned char refinedIndices[16];
+            float refinedError = FitColorEndpoints(block, first, second, refined0, refined1, refinedIndices);
+            if (refinedError < error) {
+                c0 = refined0;
+                c1 = refined1;
+                memcpy(indices, refinedIndices, sizeof(indices));
+            }
+        }
+
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; i++) {
+            bits |= (uint32_t)indices[i] << (2 * i);
+        }
+        out[0] = (unsigned char)(c0 & 0xFF);
+        out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)(c1 & 0xFF);
+        out[3] = (unsigned char)(c1 >> 8);
+        for (int i = 0; i < 4; i++) {
+            out[4 + i] = (unsigned char)(bits >> (8 * i));
+        }
+    }
+
+    static void EncodeAlphaBlock(const BlockPixels& block, unsigned char* out) {
+        float mean[4], minimum[4], maximum[4];
+        ChannelStats(block, 3, 1, mean, minimum, maximum);
+
+        int a0 = (int)lroundf(maximum[3]);
+        int a1 = (int)lroundf(minimum[3]);
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+        memset(out + 2, 0, 6);
+        if (a0 == a1) {
+            return;
+        }
+
+        // a0 > a1 selects the eight value mode
+        float palette[8][4];
+        palette[0][3] = (float)a0;
+        palette[1][3] = (float)a1;
+        for (int i = 1; i < 7; i++) {
+            palette[i + 1][3] = ((7 - i) * a0 + i * a1) / 7.0f;
+        }
+        unsigned char indices[16];
+        SelectIndices(block, 3, 1, palette, 8, indices);
+
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; i++) {
+            bits |= (uint64_t)indices[i] << (3 * i);
+        }
+        for (int i = 0; i < 6; i++) {
+            out[2 + i] = (unsigned char)(bits >> (8 * i));
+        }
+    }
+
+    // BC7 mode 6 endpoints (7 bits per channel plus one p-bit each) and indices for two float endpoints
+    struct BC7Mode6Block {
+        int endpoints[2][4];
+        int pBits[2];
+        unsigned char indices[16];
+    };
+
+    static float FitBC7Mode6(const BlockPixels& block, const float* first, const float* second, BC7Mode6Block& encoded) {
+        float bestError = FLT_MAX;
+        for (int combination = 0; combination < 4; combination++) {
+            BC7Mode6Block candidate;
+            candidate.pBits[0] = combination & 1;
+            candidate.pBits[1] = combination >> 1;
+
+            int decoded[2][4];
+            for (int c = 0; c < 4; c++) {
+                const float* source[2] = { first, second };
+                for (int e = 0; e < 2; e++) {
+                    int quantized = (int)lroundf((source[e][c] - candidate.pBits[e]) / 2.0f);
+                    candidate.endpoints[e][c] = std::min(127, std::max(0, quantized));
+                    decoded[e][c] = (candidate.endpoints[e][c] << 1) | candidate.pBits[e];
+                }
+            }
+
+            float palette[16][4];
+            for (int i = 0; i < 16; i++) {
+                for (int c = 0; c < 4; c++) {
+                    palette[i][c] = (float)(((64 - BC7_WEIGHTS[i]) * decoded[0][c] + BC7_WEIGHTS[i] * decoded[1][c] + 32) >> 6);
+                }
+            }
+            float error = SelectIndices(block, 0, 4, palette, 16, candidate.indices);
+            if (error < bestError) {
+                bestError = error;
+                encoded = candidate;
+            }
+        }
+        return bestError;
+    }
+
+    // Writes consecutive bit fields, least significant bit first
+    struct BlockBitWriter {
+        unsigned char* out;
+        int position;
+
+        void Write(uint32_t value, int bitCount) {
+            for (int i = 0; i < bitCount; i++, position++) {
+                if ((value >> i) & 1) {
+                    out[position >> 3] |= (unsigned char)(1 << (position & 7));
+                }
+            }
+        }
+    };
+
+    void TextureCompressor::EncodeBC1Block(const unsigned char* rgba, unsigned char* out) {
+        BlockPixels block;
+        LoadBlock(rgba, block);
+        EncodeColorBlock(block, out);
+    }
+
+    void TextureCompressor::EncodeBC3Block(const unsigned char* rgba, unsigned char* out) {
+        BlockPixels block;
+        LoadBlock(rgba, block);
+        EncodeAlphaBlock(block, out);
+        EncodeColorBlock(block, out + 8);
+    }
+
+    void TextureCompressor::EncodeBC7Block(const unsigned char* rgba, unsigned char* out) {
+        BlockPixels block;
+        LoadBlock(rgba, block);
+
+        float low[4], high[4];
+        PrincipalEndpoints(block, 4, low, high);
+        BC7Mode6Block encoded;
+        float error = FitBC7Mode6(block, low, high, encoded);
+
+        float weights[16];
+        for (int i = 0; i < 16; i++) {
+            weights[i] = (64 - BC7_WEIGHTS[i]) / 64.0f;
+        }
+        float first[4], second[4];
+        if (RefineEndpoints(block, 4, encoded.indices, weights, first, second)) {
+            BC7Mode6Block refined;
+            if (FitBC7Mode6(block, first, second, refined) < error) {
+                encoded = refined;
+            }
+        }
+
+        // the anchor (first) index is stored without its top bit, so it must be below 8
+        if (encoded.indices[0] >= 8) {
+            for (int c = 0; c < 4; c++) {
+                std::swap(encoded.endpoints[0][c], encoded.endpoints[1][c]);
+            }
+            std::swap(encoded.pBits[0], encoded.pBits[1]);
+            for (int i = 0; i < 16; i++) {
+                encoded.indices[i] = (unsigned char)(15 - encoded.indices[i]);
+            }
+        }
+
+        memset(out, 0, 16);
+        BlockBitWriter writer = { out, 0 };
+        writer.Write(1 << 6, 7);
+        for (int c = 0; c < 4; c++) {
+            writer.Write((uint32_t)encoded.endpoints[0][c], 7);
+            writer.Write((uint32_t)encoded.endpoints[1][c], 7);
+        }
+        writer.Write((uint32_t)encoded.pBits[0], 1);
+        writer.Write((uint32_t)encoded.pBits[1], 1);
+        writer.Write(encoded.indices[0], 3);
+        for (int i = 1; i < 16; i++) {
+            writer.Write(encoded.indices[i], 4);
+        }
+    }
+
+    size_t TextureCompressor::BlockBytes(BlockFormat format) {
+        return format == BLOCK_BC1 ? 8 : 16;
+    }
+
+    const char* TextureCompressor::FormatName(BlockFormat format) {
+        switch (format) {
+        case BLOCK_BC1: return "BC1";
+        case BLOCK_BC3: return "BC3";
+        default: return "BC7";
+        }
+    }
+
+    GLenum TextureCompressor::GLFormat(BlockFormat format, bool srgb) {
+        switch (format) {
+        case BLOCK_BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BLOCK_BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        default: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        }
+    }
+
+    TextureCompression TextureCompressor::getEffectiveCompression() {
+        if (compression == TEXTURE_BC7 && (GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc)) {
+            return TEXTURE_BC7;
+        }
+        if (compression != TEXTURE_UNCOMPRESSED && GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB) {
+            return TEXTURE_BC1_BC3;
+        }
+        return TEXTURE_UNCOMPRESSED;
+    }
+
+    // Encodes one level, texels past the right/bottom edge repeat the last column/row
+    static std::vector<unsigned char> CompressLevel(const std::vector<unsigned char>& rgba, int width, int height, BlockFormat format) {
+        int blocksX = (width + 3) / 4;
+        int blocksY = (height + 3) / 4;
+        size_t blockBytes = TextureCompressor::BlockBytes(format);
+        std::vector<unsigned char> compressed((size_t)blocksX * blocksY * blockBytes);
+
+        unsigned char texels[64];
+        for (int by = 0; by < blocksY; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                for (int y = 0; y < 4; y++) {
+                    int row = std::min(by * 4 + y, height - 1);
+                    for (int x = 0; x < 4; x++) {
+                        int column = std::min(bx * 4 + x, width - 1);
+                        memcpy(&texels[(y * 4 + x) * 4], &rgba[((size_t)row * width + column) * 4], 4);
+                    }
+                }
+
+                unsigned char* out = &compressed[((size_t)by * blocksX + bx) * blockBytes];
+                switch (format) {
+                case BLOCK_BC1: TextureCompressor::EncodeBC1Block(texels, out); break;
+                case BLOCK_BC3: TextureCompressor::EncodeBC3Block(texels, out); break;
+                default: TextureCompressor::EncodeBC7Block(texels, out); break;
+                }
+            }
+        }
+        return compressed;
+    }
+
+    bool TextureCompressor::Compress(const MipChain& chain, TextureCompression compression, CompressedImage& compressed) {
+        if (chain.levels.empty() || (chain.channels != 3 && chain.channels != 4) || compression == TEXTURE_UNCOMPRESSED) {
+            return false;
+        }
+
+        // the encoders always read four channels
+        std::vector<std::vector<unsigned char>> rgbaLevels(chain.levels.size());
+        bool hasAlpha = false;
+        for (size_t level = 0; level < chain.levels.size(); level++) {
+            const std::vector<unsigned char>& source = chain.levels[level];
+            size_t texelCount = source.size() / chain.channels;
+            std::vector<unsigned char>& rgba = rgbaLevels[level];
+            rgba.resize(texelCount * 4);
+            for (size_t i = 0; i < texelCount; i++) {
+                const unsigned char* texel = &source[i * chain.channels];
+                rgba[i * 4 + 0] = texel[0];
+                rgba[i * 4 + 1] = texel[1];
+                rgba[i * 4 + 2] = texel[2];
+                rgba[i * 4 + 3] = chain.channels == 4 ? texel[3] : 255;
+                hasAlpha = hasAlpha || rgba[i * 4 + 3] != 255;
+            }
+        }
+
+        compressed.format = compression == TEXTURE_BC7 ? BLOCK_BC7 : (hasAlpha ? BLOCK_BC3 : BLOCK_BC1);
+        compressed.width = chain.width;
+        compressed.height = chain.height;
+        compressed.levels.clear();
+
+        int width = chain.width;
+        int height = chain.height;
+        for (size_t level = 0; level < rgbaLevels.size(); level++) {
+            compressed.levels.push_back(CompressLevel(rgbaLevels[level], width, height, compressed.format));
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+
+        return true;
+    }
+
+    void TextureCompressor::Upload(GLenum target, const CompressedImage& compressed, bool srgb, const char* fileName) {
+        GLenum format = GLFormat(compressed.format, srgb);
+        int width = compressed.width;
+        int height = compressed.height;
+        for (size_t i = 0; i < compressed.levels.size(); i++) {
+            glCompressedTexImage2D(target, (GLint)i, format, width, height, 0,
+                (GLsizei)compressed.levels[i].size(), compressed.levels[i].data());
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+
+        size_t saved = compressed.getUncompressedSize() - compressed.getSize();
+        bytesSaved += saved;
+        std::cout << "Compressed texture : " << fileName << " " << FormatName(compressed.format) << " "
+            << compressed.width << "x" << compressed.height << ", " << compressed.levels.size() << " levels, "
+            << compressed.getUncompressedSize() / (1024.0 * 1024.0) << " MB -> " << compressed.getSize() / (1024.0 * 1024.0)
+            << " MB (" << saved / (1024.0 * 1024.0) << " MB saved)" << std::endl;
+    }
+
+    uint64_t TextureCompressor::getBytesSaved() {
+        return bytesSaved;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef TextureCompressor_hpp
+#define TextureCompressor_hpp
+
+#include <GL/glew.h>
+
+#include "MipChain.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // GPU block compression formats, all made of 4x4 texel blocks
+    enum BlockFormat {
+        // RGB, 8 bytes per block
+        BLOCK_BC1,
+        // BC1 color plus interpolated alpha, 16 bytes per block
+        BLOCK_BC3,
+        // BPTC, encoded in mode 6 (one RGBA subset), 16 bytes per block
+        BLOCK_BC7
+    };
+
+    // What the loaders ask the encoder for
+    enum TextureCompression {
+        TEXTURE_UNCOMPRESSED,
+        // BC1 for opaque images, BC3 when there is alpha
+        TEXTURE_BC1_BC3,
+        TEXTURE_BC7
+    };
+
+    // Block compressed mip chain of one image
+    struct CompressedImage {
+        BlockFormat format;
+        int width = 0;
+        int height = 0;
+        std::vector<std::vector<unsigned char>> levels;
+
+        size_t getSize() const;
+        // RGBA8 footprint of the same levels, what an uncompressed upload takes
+        size_t getUncompressedSize() const;
+    };
+
+    // CPU BC1/BC3/BC7 encoder, with SSE2 kernels where available
+    class TextureCompressor
+    {
+    public:
+        // Requested compression
+        static TextureCompression compression;
+
+        // Compression the loaders should use on this GPU, the requested one or the best supported fallback.
+        // Needs glewInit, only reads GLEW flags so it is safe on worker threads.
+        static TextureCompression getEffectiveCompression();
+
+        static size_t BlockBytes(BlockFormat format);
+        static const char* FormatName(BlockFormat format);
+        static GLenum GLFormat(BlockFormat format, bool srgb);
+
+        // Encode one 4x4 block of RGBA texels (64 bytes, row major)
+        static void EncodeBC1Block(const unsigned char* rgba, unsigned char* out);
+        static void EncodeBC3Block(const unsigned char* rgba, unsigned char* out);
+        static void EncodeBC7Block(const unsigned char* rgba, unsigned char* out);
+
+        // Compresses every level of an 8-bit mip chain with 3 or 4 channels
+        static bool Compress(const MipChain& chain, TextureCompression compression, CompressedImage& compressed);
+
+        // Uploads every level to `target` of the bound texture with glCompressedTexImage2D and logs the memory saved
+        static void Upload(GLenum target, const CompressedImage& compressed, bool srgb, const char* fileName);
+
+        // Total VRAM saved by the compressed uploads so far
+        static uint64_t getBytesSaved();
+
+    private:
+        static std::atomic<uint64_t> bytesSaved;
+    };
+}
+
+#endif /* TextureCompressor_hpp */
@@ -0,0 +1,198 @@
+#include "TextureContainer.hpp"
+#include "MipChain.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    bool TextureContainer::enabled = true;
+
+    static const char TEXTURE_CONTAINER_MAGIC[8] = { 'G', 'P', 'S', 'T', 'E', 'X', '\0', '\0' };
+    // bump whenever the encoders or the mip filter change their output
+    static const uint32_t TEXTURE_CONTAINER_VERSION = 2;
+
+    enum TextureContainerFlags { CONTAINER_FLIPPED = 1, CONTAINER_MIPMAPS = 2, CONTAINER_COMPRESSED = 4 };
+
+    struct TextureContainerHeader {
+        char magic[8];
+        uint32_t version;
+        // decode settings the container was built with
+        uint32_t requestedChannels;
+        uint32_t requestedCompression;
+        uint32_t flags;
+        // BlockFormat when CONTAINER_COMPRESSED is set
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;
+        uint32_t levelCount;
+        uint32_t padding;
+        uint64_t sourceSize;
+        uint64_t sourceTime;
+    };
+
+    std::string TextureContainer::ContainerPath(std::string imageFileName) {
+        return imageFileName + ".gpstex";
+    }
+
+    // Size and mtime of the source image, a container built from anything else is stale
+    static bool ReadImageStamp(std::string imageFileName, uint64_t& size, uint64_t& time) {
+        std::error_code error;
+        std::filesystem::path sourcePath(imageFileName);
+        uintmax_t fileSize = std::filesystem::file_size(sourcePath, error);
+        if (error) {
+            return false;
+        }
+        auto writeTime = std::filesystem::last_write_time(sourcePath, error);
+        if (error) {
+            return false;
+        }
+        size = (uint64_t)fileSize;
+        time = (uint64_t)writeTime.time_since_epoch().count();
+        return true;
+    }
+
+    // Bytes of one level, used to reject truncated or mislabeled containers
+    static size_t LevelSize(const TextureContainerHeader& header, int width, int height) {
+        if (header.flags & CONTAINER_COMPRESSED) {
+            return (size_t)((width + 3) / 4) * ((height + 3) / 4) * TextureCompressor::BlockBytes((BlockFormat)header.format);
+        }
+        return (size_t)width * height * header.channels;
+    }
+
+    bool TextureContainer::Read(std::string imageFileName, int channels, bool flipped, bool mipmaps, TextureCompression compression,
+        Image& image) {
+        std::ifstream in(ContainerPath(imageFileName), std::ios::binary);
+        if (!in) {
+            return false;
+        }
+
+        TextureContainerHeader header;
+        uint64_t sourceSize, sourceTime;
+        uint32_t flags = (flipped ? CONTAINER_FLIPPED : 0) | (mipmaps ? CONTAINER_MIPMAPS : 0);
+        if (!in.read((char*)&header, sizeof(header)) ||
+            memcmp(header.magic, TEXTURE_CONTAINER_MAGIC, sizeof(TEXTURE_CONTAINER_MAGIC)) != 0 ||
+            header.version != TEXTURE_CONTAINER_VERSION || header.requestedChannels != (uint32_t)channels ||
+            header.requestedCompression != (uint32_t)compression || (header.flags & ~CONTAINER_COMPRESSED) != flags ||
+            header.format > BLOCK_BC7 || header.channels < 1 || header.channels > 4 ||
+            header.levelCount < 1 || header.levelCount > 32 ||
+            !ReadImageStamp(imageFileName, sourceSize, sourceTime) ||
+            header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+            return false;
+        }
+
+        std::vector<std::vector<unsigned char>> levels(header.levelCount);
+        int width = (int)header.width;
+        int height = (int)header.height;
+        for (uint32_t i = 0; i < header.levelCount; i++) {
+            uint32_t size;
+            if (!in.read((char*)&size, sizeof(size)) || size != LevelSize(header, width, height)) {
+                std::cerr << "WARNING: ignoring corrupt texture container " << ContainerPath(imageFileName) << std::endl;
+                return false;
+            }
+            levels[i].resize(size);
+            if (!in.read((char*)levels[i].data(), size)) {
+                std::cerr << "WARNING: ignoring corrupt texture container " << ContainerPath(imageFileName) << std::endl;
+                return false;
+            }
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+
+        image.width = (int)header.width;
+        image.height = (int)header.height;
+        image.channels = (int)header.channels;
+        if (header.flags & CONTAINER_COMPRESSED) {
+            std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+            compressed->format = (BlockFormat)header.format;
+            compressed->width = image.width;
+            compressed->height = image.height;
+            compressed->levels.swap(levels);
+            image.compressed = compressed;
+        }
+        else if (!mipmaps) {
+            unsigned char* pixels = new unsigned char[levels[0].size()];
+            memcpy(pixels, levels[0].data(), levels[0].size());
+            image.pixels = std::shared_ptr<unsigned char>(pixels, std::default_delete<unsigned char[]>());
+        }
+        else {
+            std::shared_ptr<MipChain> mips = std::make_shared<MipChain>();
+            mips->width = image.width;
+            mips->height = image.height;
+            mips->channels = image.channels;
+            mips->levels.swap(levels);
+            image.mips = mips;
+        }
+        return true;
+    }
+
+    bool TextureContainer::Write(std::string imageFileName, int channels, bool flipped, bool mipmaps, TextureCompression compression,
+        const Image& image) {
+        TextureContainerHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TEXTURE_CONTAINER_MAGIC, sizeof(TEXTURE_CONTAINER_MAGIC));
+        header.version = TEXTURE_CONTAINER_VERSION;
+        header.requestedChannels = (uint32_t)channels;
+        header.requestedCompression = (uint32_t)compression;
+        header.flags = (flipped ? CONTAINER_FLIPPED : 0) | (mipmaps ? CONTAINER_MIPMAPS : 0);
+        header.width = (uint32_t)image.width;
+        header.height = (uint32_t)image.height;
+        header.channels = (uint32_t)image.channels;
+        if (!ReadImageStamp(imageFileName, header.sourceSize, header.sourceTime)) {
+            return false;
+        }
+
+        // level pointers into whichever representation the image has
+        std::vector<std::pair<const unsigned char*, size_t>> levels;
+        if (image.compressed) {
+            header.flags |= CONTAINER_COMPRESSED;
+            header.format = (uint32_t)image.compressed->format;
+            for (size_t i = 0; i < image.compressed->levels.size(); i++) {
+                levels.push_back(std::make_pair(image.compressed->levels[i].data(), image.compressed->levels[i].size()));
+            }
+        }
+        else if (image.mips) {
+            for (size_t i = 0; i < image.mips->levels.size(); i++) {
+                levels.push_back(std::make_pair(image.mips->levels[i].data(), image.mips->levels[i].size()));
+            }
+        }
+        else if (image.pixels) {
+            levels.push_back(std::make_pair((const unsigned char*)image.pixels.get(), image.getSize()));
+        }
+        else {
+            return false;
+        }
+        header.levelCount = (uint32_t)levels.size();
+
+        // same temporary file + rename as the mesh cache, so readers never see half a file
+        std::string containerPath = ContainerPath(imageFileName);
+        std::string tempPath = containerPath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            out.write((const char*)&header, sizeof(header));
+            for (size_t i = 0; i < levels.size(); i++) {
+                uint32_t size = (uint32_t)levels[i].second;
+                out.write((const char*)&size, sizeof(size));
+                out.write((const char*)levels[i].first, (std::streamsize)size);
+            }
+            if (!out) {
+                std::cerr << "WARNING: could not write texture container " << containerPath << std::endl;
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, containerPath, error);
+        if (error) {
+            std::cerr << "WARNING: could not write texture container " << containerPath << std::endl;
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+}
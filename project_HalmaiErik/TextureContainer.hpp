@@ -0,0 +1,31 @@
+#ifndef TextureContainer_hpp
+#define TextureContainer_hpp
+
+#include "Image.hpp"
+#include "TextureCompressor.hpp"
+
+#include <string>
+
+namespace gps {
+
+    // KTX-like file next to each source image (`<image>.gpstex`) holding what the decoder produced for it:
+    // the flipped base level plus its mip chain, either as raw 8-bit texels or as BC blocks.
+    // A container is only used while the source image (size and mtime) and the decode settings match.
+    class TextureContainer
+    {
+    public:
+        // read and write containers while decoding
+        static bool enabled;
+
+        static std::string ContainerPath(std::string imageFileName);
+
+        // Fills `image.pixels` (single uncompressed level), `image.mips` or `image.compressed`
+        static bool Read(std::string imageFileName, int channels, bool flipped, bool mipmaps, TextureCompression compression,
+            Image& image);
+        // Stores whichever of `image.compressed`, `image.mips` or `image.pixels` is set
+        static bool Write(std::string imageFileName, int channels, bool flipped, bool mipmaps, TextureCompression compression,
+            const Image& image);
+    };
+}
+
+#endif /* TextureContainer_hpp */
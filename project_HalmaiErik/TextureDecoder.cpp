@@ -0,0 +1,104 @@
+#include "TextureDecoder.hpp"
+#include "TextureContainer.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    TextureDecoder& TextureDecoder::getInstance() {
+        static TextureDecoder decoder;
+        return decoder;
+    }
+
+    TextureDecoder::TextureDecoder() :
+        workers(ThreadPool::getInstance()), bytesDecoded(0), inFlight(0), busyTime(0) {
+    }
+
+    std::shared_future<Image> TextureDecoder::Decode(std::string fileName, int forceChannels, bool flipVertically,
+        std::function<void()> onDecoded, TextureCompression compression, bool mipmaps) {
+        BeginDecode();
+
+        return workers.Submit([this, fileName, forceChannels, flipVertically, onDecoded, compression, mipmaps]() {
+            Image image;
+            // a fresh container skips the decode, the flip, the mip chain and the compression
+            if (TextureContainer::enabled &&
+                TextureContainer::Read(fileName, forceChannels, flipVertically, mipmaps, compression, image)) {
+                EndDecode(0);
+
+                if (onDecoded) {
+                    onDecoded();
+                }
+                return image;
+            }
+
+            // DecodeImage leaves `image` empty and reports the error when it fails
+            DecodeImage(fileName.c_str(), forceChannels, flipVertically, image);
+            EndDecode(image.pixels ? image.getSize() : 0);
+
+            if (image.pixels && (mipmaps || compression != TEXTURE_UNCOMPRESSED)) {
+                // every mipmapped texture of the scene is sampled as sRGB, so the levels are filtered in linear space
+                std::shared_ptr<MipChain> mips = std::make_shared<MipChain>();
+                GenerateMipChain(image, true, mipmaps, *mips);
+
+                std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+                if (compression != TEXTURE_UNCOMPRESSED && TextureCompressor::Compress(*mips, compression, *compressed)) {
+                    image.compressed = compressed;
+                }
+                else {
+                    image.mips = mips;
+                }
+                image.pixels.reset();
+            }
+
+            if (image.isValid() && TextureContainer::enabled) {
+                TextureContainer::Write(fileName, forceChannels, flipVertically, mipmaps, compression, image);
+            }
+
+            if (onDecoded) {
+                onDecoded();
+            }
+            return image;
+        }).share();
+    }
+
+    // Wall-clock time is only counted while at least one decode is queued or running
+    void TextureDecoder::BeginDecode() {
+        std::lock_guard<std::mutex> lock(timingMutex);
+        if (inFlight++ == 0) {
+            busySince = std::chrono::steady_clock::now();
+        }
+    }
+
+    void TextureDecoder::EndDecode(size_t bytes) {
+        bytesDecoded += bytes;
+
+        std::lock_guard<std::mutex> lock(timingMutex);
+        if (--inFlight == 0) {
+            busyTime += std::chrono::steady_clock::now() - busySince;
+        }
+    }
+
+    unsigned TextureDecoder::getThreadCount() {
+        return workers.getThreadCount();
+    }
+
+    uint64_t TextureDecoder::getBytesDecoded() {
+        return bytesDecoded;
+    }
+
+    double TextureDecoder::getBytesPerSecond() {
+        std::lock_guard<std::mutex> lock(timingMutex);
+        std::chrono::steady_clock::duration elapsed = busyTime;
+        if (inFlight > 0) {
+            elapsed += std::chrono::steady_clock::now() - busySince;
+        }
+
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        return seconds > 0.0 ? (double)bytesDecoded / seconds : 0.0;
+    }
+
+    void TextureDecoder::LogStats() {
+        std::cout << "Texture decode : " << getBytesDecoded() / (1024.0 * 1024.0) << " MB on "
+            << getThreadCount() << " threads, " << getBytesPerSecond() / (1024.0 * 1024.0) << " MB/s" << std::endl;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef TextureDecoder_hpp
+#define TextureDecoder_hpp
+
+#include "Image.hpp"
+#include "TextureCompressor.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+    // Decoded (or still decoding) images keyed by file path
+    typedef std::unordered_map<std::string, std::shared_future<Image>> PendingImages;
+
+    // Decodes and flips images into ready-to-upload pixel buffers or mip chains on the shared ThreadPool
+    class TextureDecoder
+    {
+    public:
+        static TextureDecoder& getInstance();
+
+        TextureDecoder();
+
+        // Queues a decode; `onDecoded` (optional) runs on the worker once the image is ready.
+        // With `mipmaps` the result holds its mip chain and with `compression` it is block compressed instead of pixels;
+        // all of it comes from the image's container when that is fresh.
+        // A failed decode yields an invalid Image.
+        std::shared_future<Image> Decode(std::string fileName, int forceChannels, bool flipVertically,
+            std::function<void()> onDecoded = nullptr, TextureCompression compression = TEXTURE_UNCOMPRESSED,
+            bool mipmaps = true);
+
+        unsigned getThreadCount();
+        // Total bytes of decoded pixel data
+        uint64_t getBytesDecoded();
+        // Decoded bytes per second of wall-clock time during which the pool had work
+        double getBytesPerSecond();
+        void LogStats();
+
+    private:
+        ThreadPool& workers;
+
+        std::atomic<uint64_t> bytesDecoded;
+        std::mutex timingMutex;
+        unsigned inFlight;
+        std::chrono::steady_clock::time_point busySince;
+        std::chrono::steady_clock::duration busyTime;
+
+        void BeginDecode();
+        void EndDecode(size_t bytes);
+    };
+}
+
+#endif /* TextureDecoder_hpp */
@@ -0,0 +1,73 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads consuming a FIFO of tasks
+    class ThreadPool
+    {
+    public:
+        // Pool with one worker per hardware thread shared by the asset loader, the texture decoder and the
+        // OBJ parser, so a cold load never runs more threads than there are cores
+        static ThreadPool& getInstance();
+
+        // threadCount = 0 uses one worker per hardware thread
+        explicit ThreadPool(unsigned threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Queues a task and returns a future for its result
+        template <class Task>
+        auto Submit(Task task) -> std::future<decltype(task())>
+        {
+            typedef decltype(task()) Result;
+            std::shared_ptr<std::packaged_task<Result()>> packaged =
+                std::make_shared<std::packaged_task<Result()>>(std::move(task));
+            std::future<Result> result = packaged->get_future();
+            Enqueue([packaged]() { (*packaged)(); });
+            return result;
+        }
+
+        // Waits for `result`, running queued tasks meanwhile; a task waiting on work it queued on its own pool
+        // must use this, or every worker could end up waiting on tasks nobody is left to run
+        template <class Result>
+        void Wait(std::future<Result>& result)
+        {
+            while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                // nothing queued, so the task is already running on another thread
+                if (!RunPending()) {
+                    result.wait();
+                    return;
+                }
+            }
+        }
+
+        unsigned getThreadCount();
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex tasksMutex;
+        std::condition_variable tasksAvailable;
+        bool stopping;
+
+        void Enqueue(std::function<void()> task);
+        // Runs one queued task on the calling thread, false when the queue is empty
+        bool RunPending();
+        void WorkerLoop();
+    };
+}
+
+#endif /* ThreadPool_hpp */
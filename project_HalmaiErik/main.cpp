@@ -12,20 +12,48 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
-
+#include "AssetLoader.hpp"
+#include "ObjReader.hpp"
+#include "GLState.hpp"
+#include "FrameUniforms.hpp"
+#include "GeometryArena.hpp"
+#include "RenderQueue.hpp"
+#include "ShadowAtlas.hpp"
+#include "ShadowMap.hpp"
+#include "ShaderVariants.hpp"
+
+#include <cmath>
 #include <iostream>
 
 // window
 gps::Window myWindow;
 
-const unsigned int SHADOW_WIDTH = 2048;
-const unsigned int SHADOW_HEIGHT = 2048;
+// size of each shadow cascade, 3 x 1024^2 texels in all
+const unsigned int SHADOW_CASCADE_SIZE = 1024;
+
+const GLfloat CAMERA_FOVY = glm::radians(45.0f);
+const GLfloat CAMERA_NEAR_PLANE = 0.1f;
+const GLfloat CAMERA_FAR_PLANE = 200.0f;
+// the cascades cover the view up to here, the fog hides most of what lies further
+const GLfloat SHADOW_DISTANCE = 70.0f;
+// how far towards the light, past the cascades' slices, casters are still drawn
+const GLfloat SHADOW_CASTER_DISTANCE = 35.0f;
+// point light shadows, tiles of 128 to 512 texels per cube face
+const unsigned int SHADOW_ATLAS_SIZE = 2048;
+// the lamp's 1 / (constant + linear * d + quadratic * d^2) falloff, the same terms as basic.frag's
+const GLfloat POINT_LIGHT_CONSTANT = 1.0f;
+const GLfloat POINT_LIGHT_LINEAR = 0.09f;
+const GLfloat POINT_LIGHT_QUADRATIC = 0.032f;
+// below one step of an 8 bit channel the lamp no longer shows
+const GLfloat POINT_LIGHT_CUTOFF = 1.0f / 256.0f;
+// where the attenuation reaches the cutoff, about 88 units: nothing past it is lit or shadowed by the lamp
+const GLfloat POINT_LIGHT_RANGE = (-POINT_LIGHT_LINEAR + sqrtf(POINT_LIGHT_LINEAR * POINT_LIGHT_LINEAR -
+    4.0f * POINT_LIGHT_QUADRATIC * (POINT_LIGHT_CONSTANT - 1.0f / POINT_LIGHT_CUTOFF))) / (2.0f * POINT_LIGHT_QUADRATIC);
 
 // matrices
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
-glm::mat3 normalMatrix;
 
 // light parameters
 glm::vec3 lightDir;
@@ -33,15 +61,32 @@ glm::vec3 lightColor;
 glm::mat3 lightDirMatrix;
 glm::vec3 pointLightPos;
 
-// shader uniform locations
-GLuint modelLoc;
-GLuint viewLoc;
-GLuint projectionLoc;
-GLuint normalMatrixLoc;
-GLuint lightDirLoc;
-GLuint lightColorLoc;
-GLuint lightDirMatrixLoc;
-GLuint pointLightPosLoc;
+// permutations of basic.frag, bit i of a mask turns LIT_FEATURES[i] on
+enum LitFeature {
+    LIT_SHADOWED = 1 << 0,
+    LIT_POINT_LIT = 1 << 1,
+    LIT_FOGGED = 1 << 2,
+    LIT_SPECULAR_MAP = 1 << 3
+};
+const gps::ShaderFeature LIT_FEATURES[] = {
+    { "SHADOWED", nullptr },
+    { "POINT_LIT", nullptr },
+    { "FOGGED", nullptr },
+    { "SPECULAR_MAP", "specularTexture" }
+};
+const int LIT_FEATURE_COUNT = sizeof(LIT_FEATURES) / sizeof(LIT_FEATURES[0]);
+
+// camera and light data of all programs, one uniform buffer write per frame
+gps::FrameUniforms frameUniforms;
+
+// draws of both passes, rebuilt and sorted every frame
+gps::RenderQueue renderQueue;
+// reported again whenever they change
+size_t lastCulledCount = SIZE_MAX;
+size_t lastCasterCount = SIZE_MAX;
+size_t lastVisibleCasterCount = SIZE_MAX;
+// the cached static shadow layer is redrawn this frame, so the static casters are submitted
+bool redrawStaticShadows = true;
 
 // camera
 gps::Camera myCamera(
@@ -67,16 +112,28 @@ gps::Model3D m4;
 gps::Model3D barricade;
 gps::Model3D lamp;
 
+// placements of the models drawn with one instanced draw per mesh, filled in by initInstances
+std::vector<glm::mat4> soldierInstances;
+std::vector<glm::mat4> barricadeInstances;
+
 GLfloat angle;
 
 // shaders
-gps::Shader myBasicShader;
+gps::ShaderVariants myBasicShaders;
 gps::Shader lightShader;
 gps::Shader depthMapShader;
 gps::Shader skyboxShader;
-
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
+// same passes, transforms read from the instance buffer
+gps::ShaderVariants myBasicInstancedShaders;
+gps::Shader depthMapInstancedShader;
+// distance to the lamp, for the shadow atlas
+gps::Shader pointShadowShader;
+gps::Shader pointShadowInstancedShader;
+
+// depth map of the sun, static casters cached between frames
+gps::ShadowMap shadowMap;
+// cube face tiles of the lamp, redrawn when something in its range changes
+gps::ShadowAtlas shadowAtlas;
 
 bool toLeft = true;
 bool toRight = false;
@@ -131,22 +188,18 @@ GLenum glCheckError_(const char *file, int line)
 }
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
+glm::mat4 computeProjection(int width, int height) {
+    return glm::perspective(CAMERA_FOVY, (float)width / (float)height, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+}
+
 void windowResizeCallback(GLFWwindow* window, int width, int height) {
     fprintf(stdout, "Window resized! New width: %d , and height: %d\n", width, height);
 
     WindowDimensions dim = { width, height };
     myWindow.setWindowDimensions(dim);
 
-    myBasicShader.useShaderProgram();
-
-    //set projection matrix
-    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 1000.0f);
-    //send matrix data to shader
-    GLint projLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    //set projection matrix, every program gets it with the next frame's uniform buffer update
+    projection = computeProjection(width, height);
 
     //set Viewport transform
     glViewport(0, 0, width, height);
@@ -193,9 +246,6 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
     }
 
     myCamera.rotate(pitch, yaw);
-    view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 }
 
 void processMovement() {
@@ -274,13 +324,13 @@ void initSkyBoxFaces() {
     faces.push_back("textures/skybox_custom/oasisnight_ft.tga");
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    // Return the light-space transformation matrix
-    glm::mat4 lightView = glm::lookAt(lightDir, glm::vec3(-1.0f, 0.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    const GLfloat near_plane = 1.0f, far_plane = 35.0f;
-    glm::mat4 lightProjection = glm::ortho(-40.0f, 40.0f, -8.0f, 8.0f, near_plane, far_plane);
+glm::mat4 computeLightView() {
+    return glm::lookAt(lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
 
-    return lightProjection * lightView;
+// direction the sun's light travels in
+glm::vec3 computeLightDirection() {
+    return glm::normalize(-lightDir);
 }
 
 void initOpenGLWindow() {
@@ -298,228 +348,234 @@ void initOpenGLState() {
 	glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
 	glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_FRAMEBUFFER_SRGB);
-	glEnable(GL_DEPTH_TEST); // enable depth-testing
-	glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
-	glEnable(GL_CULL_FACE); // cull face
-	glCullFace(GL_BACK); // cull back face
+	gps::GLState::getInstance().SetDepthTest(true); // enable depth-testing
+	gps::GLState::getInstance().SetDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+	gps::GLState::getInstance().SetCullFace(true); // cull face
+	gps::GLState::getInstance().SetCullMode(GL_BACK); // cull back face
 	glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 }
 
 void initModels() {
-    ground.LoadModel("models/ground_highres/ground.obj", "models/ground_highres/");
-    tank1.LoadModel("models/tanks/tank1.obj", "models/tanks/");
-    tank2.LoadModel("models/tanks/tank2.obj", "models/tanks/");
-    tank3.LoadModel("models/tanks/tank3.obj", "models/tanks/");
-    lightCube.LoadModel("models/cube/cube.obj", "models/cube/");
-    barracks.LoadModel("models/barrack/barrack.obj", "models/barrack/");
-    dog.LoadModel("models/dog/dog.obj", "models/dog/");
-    soldier.LoadModel("models/soldier/soldier.obj", "models/soldier/");
-    forest.LoadModel("models/forest/trees.obj", "models/forest/");
-    m4.LoadModel("models/gun_m4/m4.obj", "models/gun_m4/");
-    barricade.LoadModel("models/barricade/barricade.obj", "models/barricade/");
-    lamp.LoadModel("models/lamp/lamp.obj", "models/lamp/");
+    // launch every parse/decode first, then do all GL uploads here on the main thread
+    gps::AssetLoader loader;
+
+    loader.LoadSkyBox(skybox, faces);
+    loader.LoadModel(ground, "models/ground_highres/ground.obj", "models/ground_highres/");
+    loader.LoadModel(tank1, "models/tanks/tank1.obj", "models/tanks/");
+    loader.LoadModel(tank2, "models/tanks/tank2.obj", "models/tanks/");
+    loader.LoadModel(tank3, "models/tanks/tank3.obj", "models/tanks/");
+    loader.LoadModel(lightCube, "models/cube/cube.obj", "models/cube/");
+    loader.LoadModel(barracks, "models/barrack/barrack.obj", "models/barrack/");
+    loader.LoadModel(dog, "models/dog/dog.obj", "models/dog/");
+    loader.LoadModel(soldier, "models/soldier/soldier.obj", "models/soldier/");
+    loader.LoadModel(forest, "models/forest/trees.obj", "models/forest/");
+    loader.LoadModel(m4, "models/gun_m4/m4.obj", "models/gun_m4/");
+    loader.LoadModel(barricade, "models/barricade/barricade.obj", "models/barricade/");
+    loader.LoadModel(lamp, "models/lamp/lamp.obj", "models/lamp/");
+
+    loader.WaitAll();
+    gps::TextureDecoder::getInstance().LogStats();
+    std::cout << "Texture cache : " << gps::TextureCache::getInstance().getTextureCount() << " unique textures" << std::endl;
+    std::cout << "Geometry arena : " << gps::GeometryArena::getInstance().getVertexBytes() / (1024.0 * 1024.0) << " MB of vertices, "
+        << gps::GeometryArena::getInstance().getIndexBytes() / (1024.0 * 1024.0) << " MB of indices, indirect draws "
+        << (gps::GeometryArena::isMultiDrawSupported() ? "on" : "off") << std::endl;
+    std::cout << "Texture compression : " << gps::TextureCompressor::getBytesSaved() / (1024.0 * 1024.0)
+        << " MB of video memory saved" << std::endl;
 }
 
 void initShaders() {
-	myBasicShader.loadShader("shaders/basic.vert", "shaders/basic.frag");
+	myBasicShaders.Init("shaders/basic.vert", "", "shaders/basic.frag", LIT_FEATURES, LIT_FEATURE_COUNT);
     lightShader.loadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
-    depthMapShader.loadShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag");
+    depthMapShader.loadShader("shaders/depthMapShader.vert", "shaders/depthMapShader.geom", "shaders/depthMapShader.frag");
     skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
+    myBasicInstancedShaders.Init("shaders/basicInstanced.vert", "", "shaders/basic.frag", LIT_FEATURES, LIT_FEATURE_COUNT);
+    depthMapInstancedShader.loadShader("shaders/depthMapShaderInstanced.vert", "shaders/depthMapShader.geom", "shaders/depthMapShader.frag");
+    pointShadowShader.loadShader("shaders/pointShadow.vert", "shaders/pointShadow.frag");
+    pointShadowInstancedShader.loadShader("shaders/pointShadowInstanced.vert", "shaders/pointShadow.frag");
+    // every combination now, rather than the first frame a material needs one
+    myBasicShaders.PreloadAll();
+    myBasicInstancedShaders.PreloadAll();
+}
+
+void initInstances() {
+    glm::mat4 model;
+
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.0f, -3.0f));
+    model = glm::rotate(model, glm::radians(85.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    soldierInstances.push_back(model);
+
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(4.0f, 0.0f, 4.0f));
+    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    model = glm::rotate(model, glm::radians(15.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    model = glm::scale(model, glm::vec3(0.015, 0.015, 0.015));
+    barricadeInstances.push_back(model);
 }
 
 void initFBO() {
-    // Create the FBO, the depth texture and attach the depth texture to the FBO
-    glGenFramebuffers(1, &shadowMapFBO);
-
-    // create depth texture for FBO
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-    // attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture,
-        0);
-
-    // bind nothing to color and stencil attachments
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-
-    // one FBO complete => unbind until use
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    shadowMap.Init(SHADOW_CASCADE_SIZE);
+    shadowAtlas.Init(SHADOW_ATLAS_SIZE);
 }
 
 
 void initUniforms() {
-	myBasicShader.useShaderProgram();
-
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-	normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
-    lightDirMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDirMatrix");
-    pointLightPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLightPos");
+    // the lit programs read the sun's cascades from unit 3 and the shadow atlas from unit 4
+    myBasicShaders.SetSampler("shadowMap", 3);
+    myBasicShaders.SetSampler("shadowAtlas", 4);
+    myBasicInstancedShaders.SetSampler("shadowMap", 3);
+    myBasicInstancedShaders.SetSampler("shadowAtlas", 4);
 
 	// create projection matrix
-	projection = glm::perspective(glm::radians(45.0f),
-                               (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
-                               0.1f, 200.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-	// send projection matrix to shader
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));	
+	projection = computeProjection(myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
 
 	//set the light direction (direction towards the light)
 	lightDir = glm::vec3(1.0f, 8.0f, -15.0f);
-	lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-	// send light dir to shader
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
 	//set light color
 	lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-	lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-	// send light color to shader
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-}
-
-void renderScene() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // point light ----------------------------------------------------------------------------------------------
-    myBasicShader.useShaderProgram();
     pointLightPos = glm::vec3(2.0f, 1.2f, -2.3f);
-    glUniform3fv(pointLightPosLoc, 1, glm::value_ptr(pointLightPos));
-
-	// first pass ----------------------------------------------------------------------------------------------
-    depthMapShader.useShaderProgram();
 
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
-
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-
-    // TANKS ----------------
-    model = glm::mat4(1.0f);
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "model"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(model));
-    tank1.Draw(depthMapShader);
-    tank2.Draw(depthMapShader);
-    model = glm::translate(model, glm::vec3(-13.0f, 0.0f, -18.0f));
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "model"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(model));
-    tank3.Draw(depthMapShader);
-
-    // BARRACKS ----------------
-    model = glm::mat4(1.0f);
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "model"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(model));
-    barracks.Draw(depthMapShader);
-
-    // M4 ----------------
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(-5.33f, 0.0f, 2.0f));
-    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "model"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(model));
-    m4.Draw(depthMapShader);
-
-    // BARRIACDE ----------------
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(4.0f, 0.0f, 4.0f));
-    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::rotate(model, glm::radians(15.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, glm::vec3(0.015, 0.015, 0.015));
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "model"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(model));
-    barricade.Draw(depthMapShader);
-
-    // GROUND ----------------
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "model"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(model));
-    ground.Draw(depthMapShader);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    frameUniforms.Init();
+}
 
+// Sends the camera and light data of this frame to every program at once
+void updateFrameUniforms() {
+    view = myCamera.getViewMatrix();
+    lightDirMatrix = glm::mat3(glm::inverseTranspose(view));
 
+    gps::FrameData frameData;
+    frameData.view = view;
+    frameData.projection = projection;
+    // refit the cascades to where the camera looks now
+    float aspect = (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height;
+    shadowMap.UpdateCascades(view, CAMERA_FOVY, aspect, CAMERA_NEAR_PLANE, SHADOW_DISTANCE,
+        computeLightDirection(), SHADOW_CASTER_DISTANCE);
+    for (int i = 0; i < gps::SHADOW_CASCADE_COUNT; i++) {
+        frameData.lightSpaceTrMatrix[i] = shadowMap.getLightSpaceTrMatrix(i);
+        frameData.cascadeSplits[i] = shadowMap.getSplit(i);
+    }
+    frameData.setLightDirMatrix(lightDirMatrix);
+    frameData.lightDir = glm::vec4(lightDir, 0.0f);
+    frameData.lightColor = glm::vec4(lightColor, 0.0f);
+    frameData.pointLightPos = glm::vec4(pointLightPos, 1.0f);
+    frameUniforms.Update(frameData);
+}
 
+// How an object takes part in the depth map
+enum ShadowCasting {
+    SHADOW_NONE,
+    // drawn into the cached layer, which is only redrawn when the light changes
+    SHADOW_STATIC,
+    // drawn every frame over the cached layer
+    SHADOW_DYNAMIC
+};
+
+// Depth map pass `casting` puts an object in, PASS_COUNT for none or while the cached layer is still valid
+gps::RenderPass shadowPassOf(ShadowCasting casting) {
+    if (casting == SHADOW_DYNAMIC) {
+        return gps::PASS_SHADOW;
+    }
+    if (casting == SHADOW_STATIC && redrawStaticShadows) {
+        return gps::PASS_SHADOW_STATIC;
+    }
+    return gps::PASS_COUNT;
+}
 
-	// second pass ----------------------------------------------------------------------------------------------
-    myBasicShader.useShaderProgram();
+// Tells the shadow atlas where a moving caster is, the lamp faces it reaches are redrawn
+void markDynamicCaster(gps::Model3D& object, const glm::mat4* instances, GLsizei count) {
+    for (gps::Mesh& mesh : object.getMeshes()) {
+        for (GLsizei i = 0; i < count; i++) {
+            shadowAtlas.MarkDynamic(gps::TransformSphere(instances[i], mesh.bounds.center, mesh.bounds.radius));
+        }
+    }
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
+// Cheapest basic.frag features for `object`: the lamp is left out when none of its placements is in range,
+// the specular map per mesh by the queue
+uint32_t litFeaturesOf(gps::Model3D& object, const glm::mat4* instances, GLsizei count) {
+    uint32_t features = LIT_SHADOWED | LIT_FOGGED | LIT_SPECULAR_MAP;
+    for (gps::Mesh& mesh : object.getMeshes()) {
+        for (GLsizei i = 0; i < count; i++) {
+            glm::vec4 sphere = gps::TransformSphere(instances[i], mesh.bounds.center, mesh.bounds.radius);
+            if (glm::length(glm::vec3(sphere) - pointLightPos) < sphere.w + POINT_LIGHT_RANGE) {
+                return features | LIT_POINT_LIT;
+            }
+        }
+    }
+    return features;
+}
 
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "view"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(view));
+// Queues `object` for the main pass and for the depth map passes it casts its shadow in
+void submitOpaqueInstanced(gps::Model3D& object, const glm::mat4* instances, GLsizei count, ShadowCasting casting) {
+    gps::RenderPass shadowPass = shadowPassOf(casting);
+    if (shadowPass != gps::PASS_COUNT) {
+        renderQueue.SubmitInstanced(shadowPass, depthMapInstancedShader, object, instances, count);
+    }
+    if (casting != SHADOW_NONE) {
+        renderQueue.SubmitInstanced(gps::PASS_SHADOW_POINT, pointShadowInstancedShader, object, instances, count);
+    }
+    if (casting == SHADOW_DYNAMIC) {
+        markDynamicCaster(object, instances, count);
+    }
+    renderQueue.SubmitInstanced(gps::PASS_MAIN, myBasicInstancedShaders, litFeaturesOf(object, instances, count), object,
+        instances, count);
+}
 
-    lightDirMatrix = glm::mat3(glm::inverseTranspose(view));
-    glUniformMatrix3fv(lightDirMatrixLoc, 1, GL_FALSE, glm::value_ptr(lightDirMatrix));
+void submitOpaqueInstanced(gps::Model3D& object, const std::vector<glm::mat4>& instances, ShadowCasting casting) {
+    submitOpaqueInstanced(object, instances.data(), (GLsizei)instances.size(), casting);
+}
 
-    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-    myBasicShader.useShaderProgram();
+void submitOpaque(gps::Model3D& object, const glm::mat4& transform, ShadowCasting casting) {
+    // with indirect draws everything goes through the instanced programs, so each object can join a batch
+    if (gps::GeometryArena::isMultiDrawSupported()) {
+        submitOpaqueInstanced(object, &transform, 1, casting);
+        return;
+    }
+    gps::RenderPass shadowPass = shadowPassOf(casting);
+    if (shadowPass != gps::PASS_COUNT) {
+        renderQueue.Submit(shadowPass, depthMapShader, object, transform);
+    }
+    if (casting != SHADOW_NONE) {
+        renderQueue.Submit(gps::PASS_SHADOW_POINT, pointShadowShader, object, transform);
+    }
+    if (casting == SHADOW_DYNAMIC) {
+        markDynamicCaster(object, &transform, 1);
+    }
+    renderQueue.Submit(gps::PASS_MAIN, myBasicShaders, litFeaturesOf(object, &transform, 1), object, transform);
+}
 
-    //bind the depth map
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+// Builds this frame's render queue, the order of the submissions does not matter
+void submitScene() {
+    redrawStaticShadows = shadowMap.isStaticDirty();
+    gps::ShadowLight pointLight = { pointLightPos, POINT_LIGHT_RANGE };
+    shadowAtlas.Update(&pointLight, 1, view, projection);
+
+    // the casters are ordered along the light, the same for every cascade
+    float lightDistance = glm::length(lightDir);
+    renderQueue.Clear();
+    renderQueue.SetView(gps::PASS_SHADOW_STATIC, computeLightView(), lightDistance + CAMERA_FAR_PLANE);
+    renderQueue.SetView(gps::PASS_SHADOW, computeLightView(), lightDistance + CAMERA_FAR_PLANE);
+    renderQueue.SetView(gps::PASS_SHADOW_POINT, glm::lookAt(pointLightPos, pointLightPos - glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)), POINT_LIGHT_RANGE);
+    renderQueue.SetView(gps::PASS_MAIN, view, CAMERA_FAR_PLANE);
 
     // TANKS ----------------
     model = glm::mat4(1.0f);
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    tank1.Draw(myBasicShader);
-    tank2.Draw(myBasicShader);
+    submitOpaque(tank1, model, SHADOW_STATIC);
+    submitOpaque(tank2, model, SHADOW_STATIC);
     model = glm::translate(model, glm::vec3(-13.0f, 0.0f, -18.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    tank3.Draw(myBasicShader);
+    submitOpaque(tank3, model, SHADOW_STATIC);
 
     // BARRACKS ----------------
     model = glm::mat4(1.0f);
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    barracks.Draw(myBasicShader);
+    submitOpaque(barracks, model, SHADOW_STATIC);
 
     // FOREST ----------------
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-21.0f, 0.0f, 0.0f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    forest.Draw(myBasicShader);
-    
+    submitOpaque(forest, model, SHADOW_NONE);
+
     // DOG ----------------
     // animate dog
     if (toLeft) {
@@ -549,75 +605,114 @@ void renderScene() {
         model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
     }
     model = glm::scale(model, glm::vec3(0.028f, 0.028f, 0.028f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    dog.Draw(myBasicShader);
+    submitOpaque(dog, model, SHADOW_DYNAMIC);
 
     // SOLDIER ----------------
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.0f, -3.0f));
-    model = glm::rotate(model, glm::radians(85.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    soldier.Draw(myBasicShader);
+    submitOpaqueInstanced(soldier, soldierInstances, SHADOW_NONE);
 
     // M4 ----------------
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-5.33f, 0.0f, 2.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    m4.Draw(myBasicShader);
+    submitOpaque(m4, model, SHADOW_STATIC);
 
     // BARRICADE ----------------
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(4.0f, 0.0f, 4.0f));
-    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::rotate(model, glm::radians(15.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, glm::vec3(0.015, 0.015, 0.015));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    barricade.Draw(myBasicShader);
+    submitOpaqueInstanced(barricade, barricadeInstances, SHADOW_STATIC);
 
     // LAMP ----------------
     model = glm::translate(glm::mat4(1.0f), glm::vec3(1.93f, 1.05f, -2.2f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    lamp.Draw(myBasicShader);
+    submitOpaque(lamp, model, SHADOW_NONE);
 
     // GROUND ----------------
+    // only receives shadows, it has nothing to cast them on
     model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    ground.Draw(myBasicShader);
+    submitOpaque(ground, model, SHADOW_NONE);
 
     // LIGHTCUBE ----------------
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
     model = glm::translate(glm::mat4(1.0f), 1.0f * lightDir);
     model = glm::scale(model, glm::vec3(0.05f, 0.05f, 0.05f));
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    lightCube.Draw(lightShader);
+    renderQueue.Submit(gps::PASS_MAIN, lightShader, lightCube, model);
+
+    // casters outside every cascade; the moving casters are also dropped when their shadow cannot reach
+    // anything the camera sees within the shadow distance
+    size_t casters = renderQueue.getPacketCount(gps::PASS_SHADOW_STATIC) + renderQueue.getPacketCount(gps::PASS_SHADOW);
+    gps::Frustum cascades[gps::SHADOW_CASCADE_COUNT];
+    shadowMap.getFrusta(cascades);
+    renderQueue.Cull(gps::PASS_SHADOW_STATIC, cascades, gps::SHADOW_CASCADE_COUNT);
+    renderQueue.Cull(gps::PASS_SHADOW, cascades, gps::SHADOW_CASCADE_COUNT);
+    float aspect = (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height;
+    glm::mat4 shadowedView = glm::perspective(CAMERA_FOVY, aspect, CAMERA_NEAR_PLANE, SHADOW_DISTANCE) * view;
+    glm::vec3 shadowSweep = computeLightDirection() * SHADOW_CASTER_DISTANCE;
+    renderQueue.Cull(gps::PASS_SHADOW, gps::Frustum::FromMatrix(shadowedView).Extruded(shadowSweep));
+    size_t visibleCasters = renderQueue.getPacketCount(gps::PASS_SHADOW_STATIC) + renderQueue.getPacketCount(gps::PASS_SHADOW);
+    gps::Frustum pointFaces[gps::SHADOW_ATLAS_MAX_LIGHTS * gps::SHADOW_ATLAS_FACES];
+    renderQueue.Cull(gps::PASS_SHADOW_POINT, pointFaces, shadowAtlas.getFrusta(pointFaces));
+    if (casters != lastCasterCount || visibleCasters != lastVisibleCasterCount) {
+        std::cout << "Shadow casters : " << visibleCasters << " of " << casters << " meshes drawn into the depth map" << std::endl;
+        lastCasterCount = casters;
+        lastVisibleCasterCount = visibleCasters;
+    }
+
+    // nothing outside the camera's frustum reaches the GPU
+    size_t culled = renderQueue.Cull(gps::PASS_MAIN, projection * view);
+    if (culled != lastCulledCount) {
+        std::cout << "Frustum culling : " << culled << " of " << culled + renderQueue.getPacketCount(gps::PASS_MAIN)
+            << " main pass meshes culled" << std::endl;
+        lastCulledCount = culled;
+    }
+
+    renderQueue.Sort();
+}
+
+void renderScene() {
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    updateFrameUniforms();
+    submitScene();
+
+	// first pass ----------------------------------------------------------------------------------------------
+    shadowMap.Render(renderQueue);
+    const gps::Shader* pointCasterShaders[] = { &pointShadowShader, &pointShadowInstancedShader };
+    shadowAtlas.Render(renderQueue, gps::PASS_SHADOW_POINT, pointCasterShaders, 2);
+
+
+
+
+	// second pass ----------------------------------------------------------------------------------------------
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+
+    //bind the cascades and the atlas, the lit programs sample them from units 3 and 4
+    gps::GLState::getInstance().BindTexture(3, GL_TEXTURE_2D_ARRAY, shadowMap.getTexture());
+    gps::GLState::getInstance().BindTexture(4, GL_TEXTURE_2D, shadowAtlas.getTexture());
+
+    renderQueue.Execute(gps::PASS_MAIN);
 
     // SKYBOX ----------------
-    skybox.Draw(skyboxShader, view, projection);
+    skybox.Draw(skyboxShader);
 
 }
 
 void cleanup() {
+    gps::GLState::getInstance().LogStats();
+    std::cout << "Render queue : shadow pass " << renderQueue.getPacketCount(gps::PASS_SHADOW) << " packets in "
+        << renderQueue.getDrawCallCount(gps::PASS_SHADOW) << " draw calls, main pass " << renderQueue.getPacketCount(gps::PASS_MAIN)
+        << " packets in " << renderQueue.getDrawCallCount(gps::PASS_MAIN) << " draw calls" << std::endl;
+    std::cout << "Shadow map : static casters drawn " << shadowMap.getStaticRenderCount() << " times" << std::endl;
+    std::cout << "Shadow atlas : " << shadowAtlas.getFaceRenderCount() << " point light faces drawn" << std::endl;
+    frameUniforms.Delete();
+    shadowMap.Delete();
+    shadowAtlas.Delete();
     myWindow.Delete();
-
-    glDeleteTextures(1, &depthMapTexture);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDeleteFramebuffers(1, &shadowMapFBO);
 }
 
 int main(int argc, const char * argv[]) {
 
+    // --bench-obj : compare the OBJ parsers on the two largest models and exit
+    if (argc > 1 && std::string(argv[1]) == "--bench-obj") {
+        gps::ObjReader::Benchmark("models/ground_highres/ground.obj", "models/ground_highres/");
+        gps::ObjReader::Benchmark("models/soldier/soldier.obj", "models/soldier/");
+        return EXIT_SUCCESS;
+    }
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
@@ -626,20 +721,23 @@ int main(int argc, const char * argv[]) {
     }
 
     initSkyBoxFaces();
-    skybox.Load(faces);
 
     initOpenGLState();
     initFBO();
 	initModels();
+    initInstances();
 	initShaders();
 	initUniforms();
     setWindowCallbacks();
+    // uploads and mesh setup bound objects behind the state tracker's back
+    gps::GLState::getInstance().Invalidate();
 
 	glCheckError();
 	// application loop
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
         processMovement();
 	    renderScene();
+        gps::GLState::getInstance().EndFrame();
 
 		glfwPollEvents();
 		glfwSwapBuffers(myWindow.getWindow());
@@ -1,24 +1,44 @@
 #version 410 core
 
 in vec3 fNormal;
+in vec3 fNormalEye;
 in vec2 fTexCoords;
 in vec4 fPosEye;
-in vec4 fPosLightSpace;
 in vec4 fPos;
 
 out vec4 fColor;
 
-//matrices
-uniform mat3 normalMatrix;
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-uniform mat3 lightDirMatrix;
-uniform vec3 pointLightPos;
+// per frame camera and light data, shared by every program (FrameUniforms)
+#include "frameData.glsl"
+
+// Permutations (ShaderVariants), each feature is compiled in only when #defined:
+// SHADOWED     sun cascades, and the atlas tiles of the point light when POINT_LIT is on too
+// POINT_LIT    the lamp point light
+// FOGGED       exponential squared fog
+// SPECULAR_MAP the material has a specular texture; without one there is no specular light
+
+#if defined(POINT_LIT) && defined(SHADOWED)
+// point light shadow tiles, six per light (ShadowAtlas)
+layout(std140) uniform ShadowAtlasData {
+	mat4 pointShadowFaceMatrix[24];
+	vec4 pointShadowFaceRect[24];
+	vec4 pointShadowLights[4];
+};
+#endif
+
 // textures
 uniform sampler2D diffuseTexture;
+#ifdef SPECULAR_MAP
 uniform sampler2D specularTexture;
-uniform sampler2D shadowMap;
+#endif
+#ifdef SHADOWED
+// one layer per cascade, nearest first
+uniform sampler2DArray shadowMap;
+#endif
+#if defined(POINT_LIT) && defined(SHADOWED)
+// distance to the light over its range, in tiles of pointShadowFaceRect
+uniform sampler2D shadowAtlas;
+#endif
 
 //components
 vec3 ambient;
@@ -28,10 +48,12 @@ vec3 specular;
 float specularStrength = 0.5f;
 float shininess = 64.0f;
 
-//point light
+#ifdef POINT_LIT
+//point light, main.cpp derives the lamp range from the same terms
 float constant = 1.0f;
 float linear = 0.09f;
 float quadratic = 0.032f;
+#endif
 
 vec3 viewDirN;
 
@@ -40,16 +62,13 @@ void computeLightComponents()
     vec3 cameraPosEye = vec3(0.0f);//in eye coordinates, the viewer is situated at the origin
     
     //transform normal
-    vec3 normalEye = normalize(normalMatrix * fNormal);  
+    vec3 normalEye = normalize(fNormalEye);
     
     //compute light direction
     vec3 lightDirN = normalize(lightDirMatrix * lightDir);  
 
     //compute view direction 
     viewDirN = normalize(cameraPosEye - fPosEye.xyz);
-    
-    //compute half vector
-    vec3 halfVector = normalize(lightDirN + viewDirN);
         
     //compute ambient light
     ambient = ambientStrength * lightColor;
@@ -57,32 +76,104 @@ void computeLightComponents()
     //compute diffuse light
     diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
     
+#ifdef SPECULAR_MAP
+    //compute half vector
+    vec3 halfVector = normalize(lightDirN + viewDirN);
+
     //compute specular light
     float specCoeff = pow(max(dot(halfVector, normalEye), 0.0f), shininess);
     specular = specularStrength * specCoeff * lightColor;
+#else
+    specular = vec3(0.0f);
+#endif
+}
+
+#if defined(POINT_LIT) && defined(SHADOWED)
+// 1 when the point light `light` of the atlas is blocked before reaching the fragment
+float computePointShadow(int light)
+{
+	vec4 lightPosRange = pointShadowLights[light];
+	vec3 toFragment = fPos.xyz - lightPosRange.xyz;
+	float distance = length(toFragment);
+	// no tile this frame, or out of reach
+	if (lightPosRange.w <= 0.0f || distance >= lightPosRange.w)
+		return 0.0f;
+
+	// cube face the fragment is seen through, +X -X +Y -Y +Z -Z
+	vec3 absolute = abs(toFragment);
+	int face;
+	if (absolute.x >= absolute.y && absolute.x >= absolute.z)
+		face = toFragment.x > 0.0f ? 0 : 1;
+	else if (absolute.y >= absolute.z)
+		face = toFragment.y > 0.0f ? 2 : 3;
+	else
+		face = toFragment.z > 0.0f ? 4 : 5;
+	int index = light * 6 + face;
+
+	vec4 faceClip = pointShadowFaceMatrix[index] * fPos;
+	vec2 faceCoords = faceClip.xy / faceClip.w * 0.5f + 0.5f;
+	// stay half a texel inside the tile, the neighbouring tiles belong to other faces
+	vec4 rect = pointShadowFaceRect[index];
+	vec2 halfTexel = 0.5f / vec2(textureSize(shadowAtlas, 0));
+	vec2 atlasCoords = clamp(rect.xy + faceCoords * rect.zw, rect.xy + halfTexel, rect.xy + rect.zw - halfTexel);
+
+	float closestDistance = texture(shadowAtlas, atlasCoords).r;
+	float bias = 0.05f / lightPosRange.w;
+	return distance / lightPosRange.w - bias > closestDistance ? 1.0f : 0.0f;
 }
+#endif
 
-vec3 computePointLight() {
+#ifdef POINT_LIT
+// `ambient`, `diffuse` and `specular` are the sun's terms, already modulated by the material
+vec3 computePointLight(vec3 diffuseColor, vec3 specularColor) {
 	vec3 posLightColor = vec3(1.0f, 1.0f, 0.0f);
+#ifdef SHADOWED
+	float shadow = computePointShadow(0);
+#else
+	float shadow = 0.0f;
+#endif
 
 	vec3 lightDirN = normalize(pointLightPos - fPos.xyz);
 	float diff = max(dot(fNormal, lightDirN), 0.0f);
-	vec3 reflectDir = reflect(-lightDirN, fNormal);
-	float spec = pow(max(dot(viewDirN, reflectDir), 0.0f), shininess);
 
 	float distance = length(pointLightPos - fPos.xyz);
     float attenuation = 1.0 / (constant + linear * distance + quadratic * (distance * distance)); 
 
-    vec3 ambientPoint = (ambient * vec3(texture(diffuseTexture, fTexCoords).rgb) * posLightColor) * attenuation;
-    vec3 diffusePoint = (diffuse * diff * vec3(texture(diffuseTexture, fTexCoords).rgb) * posLightColor) * attenuation;
-    vec3 specularPoint = (specular * spec * vec3(texture(specularTexture, fTexCoords).rgb) * posLightColor) * attenuation;
+    vec3 ambientPoint = (ambient * diffuseColor * posLightColor) * attenuation;
+    vec3 diffusePoint = (1.0f - shadow) * (diffuse * diff * diffuseColor * posLightColor) * attenuation;
+#ifdef SPECULAR_MAP
+	vec3 reflectDir = reflect(-lightDirN, fNormal);
+	float spec = pow(max(dot(viewDirN, reflectDir), 0.0f), shininess);
+    vec3 specularPoint = (1.0f - shadow) * (specular * spec * specularColor * posLightColor) * attenuation;
+#else
+    vec3 specularPoint = vec3(0.0f);
+#endif
 
     return (ambientPoint + diffusePoint + specularPoint);
 }
+#endif
+
+#ifdef SHADOWED
+// nearest cascade whose range still covers the fragment, -1 beyond the last one
+int selectCascade()
+{
+    float viewDepth = -fPosEye.z;
+    for (int i = 0; i < 3; i++) {
+        if (viewDepth <= cascadeSplits[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
 
 float computeShadow()
 {   
+    int cascade = selectCascade();
+    if (cascade < 0)
+        return 0.0f;
+
     // perform perspective divide
+    vec4 fPosLightSpace = lightSpaceTrMatrix[cascade] * fPos;
     vec3 normalizedCoords = fPosLightSpace.xyz / fPosLightSpace.w;
     if(normalizedCoords.z > 1.0f)
         return 0.0f;
@@ -90,7 +181,7 @@ float computeShadow()
     // Transform to [0,1] range
     normalizedCoords = normalizedCoords * 0.5f + 0.5f;
     // Get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-    float closestDepth = texture(shadowMap, normalizedCoords.xy).r;    
+    float closestDepth = texture(shadowMap, vec3(normalizedCoords.xy, cascade)).r;    
     // Get depth of current fragment from light's perspective
     float currentDepth = normalizedCoords.z;
 
@@ -107,7 +198,9 @@ float computeShadow()
 
     return shadow;  
 }
+#endif
 
+#ifdef FOGGED
 float computeFog()
 {
     float fogDensity = 0.02f; 
@@ -116,27 +209,45 @@ float computeFog()
 
     return clamp(fogFactor, 0.0f, 1.0f); 
 }
+#endif
 
 void main() 
 {
+    // each material texture is read once
+    vec3 diffuseColor = texture(diffuseTexture, fTexCoords).rgb;
+#ifdef SPECULAR_MAP
+    vec3 specularColor = texture(specularTexture, fTexCoords).rgb;
+#else
+    vec3 specularColor = vec3(0.0f);
+#endif
+
     computeLightComponents();
-    computePointLight();
 
+#ifdef SHADOWED
     float shadow = computeShadow();
+#else
+    float shadow = 0.0f;
+#endif
 
     // modulate with diffuse map
-    ambient *= vec3(texture(diffuseTexture, fTexCoords));
-    diffuse *= vec3(texture(diffuseTexture, fTexCoords));
+    ambient *= diffuseColor;
+    diffuse *= diffuseColor;
     // modulate with specular map
-    specular *= vec3(texture(specularTexture, fTexCoords));
+    specular *= specularColor;
 
     //modulate with shadow
     vec3 color = min((ambient + (1.0f - shadow) * diffuse) + (1.0f - shadow) * specular, 1.0f);
 
-    color += computePointLight();
+#ifdef POINT_LIT
+    color += computePointLight(diffuseColor, specularColor);
+#endif
 
+#ifdef FOGGED
     vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
     float fogFactor = computeFog();
     
     fColor = fogColor * (1 - fogFactor) + vec4(color, 1.0f) * fogFactor;
+#else
+    fColor = vec4(color, 1.0f);
+#endif
 }
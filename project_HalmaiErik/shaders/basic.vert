@@ -5,23 +5,27 @@ layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
 out vec3 fNormal;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
 out vec4 fPosEye;
-out vec4 fPosLightSpace;
 out vec4 fPos;
 
+// per frame camera and light data, shared by every program (FrameUniforms)
+#include "frameData.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
+uniform mat3 normalMatrix;
+
+#include "vertexDecode.glsl"
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fNormal = vNormal;
+	vec3 position = decodePosition(vPosition);
+	gl_Position = projection * view * model * vec4(position, 1.0f);
+	fNormal = decodeNormal(vNormal);
+	fNormalEye = normalMatrix * fNormal;
 	fTexCoords = vTexCoords;
-	fPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
-	fPosEye = view * model * vec4(vPosition, 1.0f);
+	fPosEye = view * model * vec4(position, 1.0f);
 
-	fPos = model * vec4(vPosition, 1.0f);
+	fPos = model * vec4(position, 1.0f);
 }
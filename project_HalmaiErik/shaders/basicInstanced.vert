@@ -0,0 +1,33 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+// per instance transform, streamed by InstanceBuffer
+layout(location=3) in mat4 instanceModel;
+layout(location=7) in mat3 instanceNormalMatrix;
+
+out vec3 fNormal;
+out vec3 fNormalEye;
+out vec2 fTexCoords;
+out vec4 fPosEye;
+out vec4 fPos;
+
+// per frame camera and light data, shared by every program (FrameUniforms)
+#include "frameData.glsl"
+
+#define INSTANCED_DECODE
+#include "vertexDecode.glsl"
+
+void main() 
+{
+	vec3 position = decodePosition(vPosition);
+	gl_Position = projection * view * instanceModel * vec4(position, 1.0f);
+	fNormal = decodeNormal(vNormal);
+	// the view is rigid, so its upper 3x3 is its own inverse transpose
+	fNormalEye = mat3(view) * instanceNormalMatrix * fNormal;
+	fTexCoords = vTexCoords;
+	fPosEye = view * instanceModel * vec4(position, 1.0f);
+
+	fPos = instanceModel * vec4(position, 1.0f);
+}
@@ -2,10 +2,15 @@
 
 layout(location=0) in vec3 vPosition;
 
-uniform mat4 lightSpaceTrMatrix;
+// per frame camera and light data, shared by every program (FrameUniforms)
+#include "frameData.glsl"
+
 uniform mat4 model;
 
+#include "vertexDecode.glsl"
+
 void main()
 {
-    gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+    // world space, depthMapShader.geom projects it into every cascade
+    gl_Position = model * vec4(decodePosition(vPosition), 1.0f);
 }
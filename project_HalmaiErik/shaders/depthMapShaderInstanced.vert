@@ -0,0 +1,17 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+// per instance transform, streamed by InstanceBuffer
+layout(location=3) in mat4 instanceModel;
+
+// per frame camera and light data, shared by every program (FrameUniforms)
+#include "frameData.glsl"
+
+#define INSTANCED_DECODE
+#include "vertexDecode.glsl"
+
+void main()
+{
+    // world space, depthMapShader.geom projects it into every cascade
+    gl_Position = instanceModel * vec4(decodePosition(vPosition), 1.0f);
+}
@@ -0,0 +1,11 @@
+// FrameData uniform block, std140; FrameUniforms.hpp holds the matching CPU struct and SHADOW_CASCADE_COUNT
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix[3];
+	vec4 cascadeSplits;
+	mat3 lightDirMatrix;
+	vec3 lightDir;
+	vec3 lightColor;
+	vec3 pointLightPos;
+};
@@ -4,11 +4,14 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
+// per frame camera and light data, shared by every program (FrameUniforms)
+#include "frameData.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+#include "vertexDecode.glsl"
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	gl_Position = projection * view * model * vec4(decodePosition(vPosition), 1.0f);
 }
@@ -0,0 +1,15 @@
+#version 410 core
+
+in vec3 fPos;
+
+out vec4 fColor;
+
+uniform vec3 lightPosition;
+uniform float lightRange;
+
+void main()
+{
+	// distance to the light instead of the projected depth: the same for all six faces and linear, so one bias fits
+	gl_FragDepth = length(fPos - lightPosition) / lightRange;
+	fColor = vec4(1.0f);
+}
@@ -0,0 +1,18 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+out vec3 fPos;
+
+uniform mat4 model;
+// world to clip space of the cube face being drawn (ShadowAtlas)
+uniform mat4 faceSpaceTrMatrix;
+
+#include "vertexDecode.glsl"
+
+void main()
+{
+	vec4 worldPosition = model * vec4(decodePosition(vPosition), 1.0f);
+	fPos = worldPosition.xyz;
+	gl_Position = faceSpaceTrMatrix * worldPosition;
+}
@@ -0,0 +1,20 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+// per instance transform, streamed by InstanceBuffer
+layout(location=3) in mat4 instanceModel;
+
+out vec3 fPos;
+
+// world to clip space of the cube face being drawn (ShadowAtlas)
+uniform mat4 faceSpaceTrMatrix;
+
+#define INSTANCED_DECODE
+#include "vertexDecode.glsl"
+
+void main()
+{
+	vec4 worldPosition = instanceModel * vec4(decodePosition(vPosition), 1.0f);
+	fPos = worldPosition.xyz;
+	gl_Position = faceSpaceTrMatrix * worldPosition;
+}
@@ -0,0 +1,29 @@
+// Mesh vertex layout: quantized positions are stored in [0, 1] inside the mesh bounds.
+// Instanced shaders define INSTANCED_DECODE before the include: the decode of the mesh then comes with each
+// instance, so indirect draws of different meshes can share a call.
+#ifdef INSTANCED_DECODE
+layout(location=10) in vec3 positionScale;
+layout(location=11) in vec3 positionOffset;
+#else
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#endif
+uniform bool octahedralNormals;
+
+vec3 decodePosition(vec3 stored)
+{
+	return positionOffset + stored * positionScale;
+}
+
+vec3 decodeNormal(vec3 stored)
+{
+	if (!octahedralNormals) {
+		return stored;
+	}
+	// unfold the octahedron, the lower hemisphere was mirrored over the diagonals
+	vec3 n = vec3(stored.xy, 1.0f - abs(stored.x) - abs(stored.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}